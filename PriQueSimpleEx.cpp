@@ -1,379 +1,3832 @@
 #include <iostream>
 #include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
 
 using namespace std;
 
-class Order
+enum class SideType
+{
+    BUY,
+    SELL
+};
+
+enum class AllocationPolicy
+{
+    FIFO,
+    PRORATA,
+    TOPPRORATA,
+    SPLIT
+};
+
+enum class IndexMode
+{
+    AUTO,
+    NATIVE,
+    LADDER,
+    BITMAP
+};
+
+struct Sell;
+struct Buy
+{
+    static constexpr SideType type=SideType::BUY;
+    static constexpr int index=0;
+    using Opposite=Sell;
+    static constexpr bool better(int price1,int price2)
+    {
+        return price1>price2;
+    }
+    static constexpr bool crosses(int price,int oppositePrice)
+    {
+        return price>=oppositePrice;
+    }
+};
+struct Sell
+{
+    static constexpr SideType type=SideType::SELL;
+    static constexpr int index=1;
+    using Opposite=Buy;
+    static constexpr bool better(int price1,int price2)
+    {
+        return price1<price2;
+    }
+    static constexpr bool crosses(int price,int oppositePrice)
+    {
+        return price<=oppositePrice;
+    }
+};
+
+enum class TraceType : uint8_t
+{
+    MESSAGE_RECEIVED,
+    PARSE_DONE,
+    MESSAGE_BEGIN,
+    MESSAGE_END,
+    MATCH_BEGIN,
+    MATCH_END,
+    FILL,
+    BATCH_END,
+    ALLOC_SLOW,
+    LOG_SHIPPED,
+    LOG_ACKED
+};
+
+struct TraceEvent
+{
+    uint64_t ticks;
+    uint32_t arg;
+    TraceType type;
+};
+
+class Tracer
+{
+private:
+    static const int ringSize=1<<16;
+    struct Ring
+    {
+        TraceEvent events[ringSize];
+        atomic<uint64_t> head{0};
+        int tid=0;
+    };
+    atomic<bool> enabled{false};
+    atomic<bool> dumpRequested{false};
+    vector<unique_ptr<Ring>> rings;
+    mutex ringsLock;
+    uint64_t startTicks=0;
+    chrono::steady_clock::time_point startTime;
+    string path;
+    static uint64_t ticks()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+    Ring& ring()
+    {
+        thread_local Ring *threadRing=nullptr;
+        if(threadRing==nullptr)
+        {
+            lock_guard<mutex> guard(ringsLock);
+            rings.push_back(make_unique<Ring>());
+            threadRing=rings.back().get();
+            threadRing->tid=(int)rings.size();
+        }
+        return *threadRing;
+    }
+    static vector<TraceEvent> collect(const Ring &currRing)
+    {
+        uint64_t head=currRing.head.load(memory_order_acquire);
+        uint64_t first=head>(uint64_t)ringSize?head-ringSize:0;
+        vector<TraceEvent> events;
+        events.reserve(head-first);
+        for(uint64_t n=first;n<head;n++)
+        {
+            events.push_back(currRing.events[n&(ringSize-1)]);
+        }
+        uint64_t after=currRing.head.load(memory_order_acquire);
+        if(after+1>first+ringSize)
+        {
+            size_t overwritten=min((size_t)(after+1-first-ringSize),events.size());
+            events.erase(events.begin(),events.begin()+overwritten);
+        }
+        return events;
+    }
+public:
+    void enable(const string &dumpPath)
+    {
+        path=dumpPath;
+        startTicks=ticks();
+        startTime=chrono::steady_clock::now();
+        enabled.store(true,memory_order_release);
+    }
+    bool isEnabled() const
+    {
+        return enabled.load(memory_order_relaxed);
+    }
+    void record(TraceType type,uint64_t arg=0)
+    {
+        if(!enabled.load(memory_order_relaxed))
+        {
+            return;
+        }
+        Ring &currRing=ring();
+        uint64_t head=currRing.head.load(memory_order_relaxed);
+        currRing.events[head&(ringSize-1)]={ticks(),(uint32_t)arg,type};
+        currRing.head.store(head+1,memory_order_release);
+    }
+    void requestDump()
+    {
+        dumpRequested.store(true,memory_order_relaxed);
+    }
+    void dumpIfRequested()
+    {
+        if(dumpRequested.exchange(false,memory_order_relaxed))
+        {
+            dump("");
+        }
+    }
+    bool dump(const string &dumpPath)
+    {
+        if(!isEnabled())
+        {
+            return false;
+        }
+        string file=dumpPath==""?path:dumpPath;
+        double nsPerTick=(double)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now()-startTime).count()/max<uint64_t>(ticks()-startTicks,1);
+        vector<pair<int,vector<TraceEvent>>> threads;
+        {
+            lock_guard<mutex> guard(ringsLock);
+            for(auto &currRing:rings)
+            {
+                threads.push_back({currRing->tid,collect(*currRing)});
+            }
+        }
+        bool binary=file.size()>=4 && file.compare(file.size()-4,4,".bin")==0;
+        ofstream out(file,binary?ios::binary:ios::out);
+        if(binary)
+        {
+            uint32_t count=threads.size();
+            out.write("EXTRACE1",8);
+            out.write((const char*)&nsPerTick,sizeof(nsPerTick));
+            out.write((const char*)&startTicks,sizeof(startTicks));
+            out.write((const char*)&count,sizeof(count));
+            for(auto &thread:threads)
+            {
+                uint32_t header[2]={(uint32_t)thread.first,(uint32_t)thread.second.size()};
+                out.write((const char*)header,sizeof(header));
+                out.write((const char*)thread.second.data(),thread.second.size()*sizeof(TraceEvent));
+            }
+            return (bool)out;
+        }
+        static const char *names[]={"received","parsed","message","message","match","match","fill","batch","alloc","shipped","acked"};
+        out<<"{\"traceEvents\":["<<endl;
+        bool first=true;
+        out<<fixed<<setprecision(3);
+        for(auto &thread:threads)
+        {
+            for(const TraceEvent &event:thread.second)
+            {
+                char phase='i';
+                if(event.type==TraceType::MESSAGE_BEGIN || event.type==TraceType::MATCH_BEGIN)
+                {
+                    phase='B';
+                }
+                else if(event.type==TraceType::MESSAGE_END || event.type==TraceType::MATCH_END)
+                {
+                    phase='E';
+                }
+                double micros=((double)event.ticks-(double)startTicks)*nsPerTick/1000;
+                out<<(first?"":",\n")<<"{\"name\":\""<<names[(int)event.type]<<"\",\"ph\":\""<<phase<<"\",\"ts\":"<<micros<<",\"pid\":"<<getpid()<<",\"tid\":"<<thread.first;
+                if(phase=='i')
+                {
+                    out<<",\"s\":\"t\"";
+                }
+                out<<",\"args\":{\"arg\":"<<event.arg<<"}}";
+                first=false;
+            }
+        }
+        out<<"\n]}"<<endl;
+        return (bool)out;
+    }
+};
+Tracer tracer;
+
+enum class MemoryAccount
+{
+    ARENA,
+    ORDER_IDS,
+    ORDER_WINDOW,
+    ORDER_MAP,
+    LEVELS,
+    LEVEL_INDEX,
+    LADDER,
+    STOPS,
+    EXPIRIES,
+    OWNERS,
+    ANALYTICS,
+    PRINT,
+    COUNT
+};
+
+class MemoryUsage
+{
+private:
+    static const int accounts=(int)MemoryAccount::COUNT;
+    long long live[accounts]={};
+    long long peak[accounts]={};
+    long long allocations[accounts]={};
+    long long totalLive=0;
+    long long totalPeak=0;
+public:
+    void allocated(MemoryAccount account,long long bytes)
+    {
+        int index=(int)account;
+        live[index]+=bytes;
+        peak[index]=max(peak[index],live[index]);
+        allocations[index]++;
+        totalLive+=bytes;
+        totalPeak=max(totalPeak,totalLive);
+    }
+    void released(MemoryAccount account,long long bytes)
+    {
+        live[(int)account]-=bytes;
+        totalLive-=bytes;
+    }
+    long long total() const
+    {
+        return totalLive;
+    }
+    long long variable() const
+    {
+        return totalLive-live[(int)MemoryAccount::ORDER_WINDOW];
+    }
+    void print() const
+    {
+        static const char *names[]={"ARENA","ORDER_IDS","ORDER_WINDOW","ORDER_MAP","LEVELS","LEVEL_INDEX","LADDER","STOPS","EXPIRIES","OWNERS","ANALYTICS","PRINT"};
+        for(int index=0;index<accounts;index++)
+        {
+            cout<<names[index]<<" "<<live[index]<<" "<<peak[index]<<" "<<allocations[index]<<endl;
+        }
+        cout<<"TOTAL "<<totalLive<<" "<<totalPeak<<endl;
+    }
+};
+MemoryUsage memoryUsage;
+
+template<class T,MemoryAccount account>
+struct CountingAllocator
+{
+    typedef T value_type;
+    template<class U>
+    struct rebind
+    {
+        typedef CountingAllocator<U,account> other;
+    };
+    CountingAllocator()=default;
+    template<class U>
+    CountingAllocator(const CountingAllocator<U,account>&){}
+    T* allocate(size_t n)
+    {
+        memoryUsage.allocated(account,n*sizeof(T));
+        return allocator<T>().allocate(n);
+    }
+    void deallocate(T *pointer,size_t n)
+    {
+        memoryUsage.released(account,n*sizeof(T));
+        allocator<T>().deallocate(pointer,n);
+    }
+    template<class U>
+    bool operator==(const CountingAllocator<U,account>&) const
+    {
+        return true;
+    }
+    template<class U>
+    bool operator!=(const CountingAllocator<U,account>&) const
+    {
+        return false;
+    }
+};
+template<class T,MemoryAccount account>
+using CountedVector=vector<T,CountingAllocator<T,account>>;
+template<class Key,class Value,MemoryAccount account>
+using CountedHashMap=unordered_map<Key,Value,hash<Key>,equal_to<Key>,CountingAllocator<pair<const Key,Value>,account>>;
+
+inline long long heapBytes(const string &text)
+{
+    static const size_t inlineCapacity=string().capacity();
+    return text.capacity()>inlineCapacity?text.capacity()+1:0;
+}
+
+inline unsigned long long hashMix(unsigned long long value)
+{
+    value=(value^(value>>30))*0xbf58476d1ce4e5b9ULL;
+    value=(value^(value>>27))*0x94d049bb133111ebULL;
+    return value^(value>>31);
+}
+
+inline unsigned long long hashID(const string &ordID)
+{
+    unsigned long long hash=0xcbf29ce484222325ULL;
+    for(unsigned char c:ordID)
+    {
+        hash=(hash^c)*0x100000001b3ULL;
+    }
+    return hash;
+}
+
+class OrderArena
 {
 private:
-    string orderID;
-    string orderType;
-    string executionType;
-    int priceBid;
-    int quantity;
-    int turn;
+    template<class T>
+    using ArenaVector=CountedVector<T,MemoryAccount::ARENA>;
+    ArenaVector<int> priceBid;
+    ArenaVector<int> quantity;
+    ArenaVector<int> turn;
+    ArenaVector<int> next;
+    ArenaVector<int> prev;
+    ArenaVector<string> orderID;
+    ArenaVector<int> originalQuantity;
+    ArenaVector<SideType> side;
+    ArenaVector<string> executionType;
+    ArenaVector<int> peakQuantity;
+    ArenaVector<int> hiddenQuantity;
+    ArenaVector<int> triggerPrice;
+    ArenaVector<long long> expiryTime;
+    ArenaVector<unsigned long long> idHash;
+    ArenaVector<int> freeSlots;
+    static void assignString(string &field,const string &value)
+    {
+        long long before=heapBytes(field);
+        field=value;
+        long long after=heapBytes(field);
+        if(after!=before)
+        {
+            memoryUsage.released(MemoryAccount::ORDER_IDS,before);
+            memoryUsage.allocated(MemoryAccount::ORDER_IDS,after);
+        }
+    }
+public:
+    ~OrderArena()
+    {
+        for(size_t slot=0;slot<orderID.size();slot++)
+        {
+            memoryUsage.released(MemoryAccount::ORDER_IDS,heapBytes(orderID[slot])+heapBytes(executionType[slot]));
+        }
+    }
+    int createOrder(const string &ordID, SideType sd, const string &execType, int priceB,int qty,int tn)
+    {
+        int slot;
+        if(!freeSlots.empty())
+        {
+            slot=freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else
+        {
+            slot=(int)priceBid.size();
+            if(priceBid.size()==priceBid.capacity())
+            {
+                tracer.record(TraceType::ALLOC_SLOW,slot+1);
+            }
+            priceBid.push_back(0);
+            quantity.push_back(0);
+            turn.push_back(0);
+            next.push_back(-1);
+            prev.push_back(-1);
+            orderID.emplace_back();
+            originalQuantity.push_back(0);
+            side.push_back(SideType::BUY);
+            executionType.emplace_back();
+            peakQuantity.push_back(0);
+            hiddenQuantity.push_back(0);
+            triggerPrice.push_back(0);
+            expiryTime.push_back(0);
+            idHash.push_back(0);
+        }
+        assignString(orderID[slot],ordID);
+        side[slot]=sd;
+        assignString(executionType[slot],execType);
+        originalQuantity[slot]=qty;
+        peakQuantity[slot]=0;
+        hiddenQuantity[slot]=0;
+        triggerPrice[slot]=0;
+        expiryTime[slot]=0;
+        idHash[slot]=hashID(ordID);
+        priceBid[slot]=priceB;
+        quantity[slot]=qty;
+        turn[slot]=tn;
+        return slot;
+    }
+    void makeIceberg(int slot,int peak)
+    {
+        peakQuantity[slot]=peak;
+        hiddenQuantity[slot]=quantity[slot]-min(peak,quantity[slot]);
+        quantity[slot]-=hiddenQuantity[slot];
+    }
+    int takeHidden(int slot)
+    {
+        int displayed=min(peakQuantity[slot],hiddenQuantity[slot]);
+        hiddenQuantity[slot]-=displayed;
+        return displayed;
+    }
+    void modifyOrder(int slot, SideType sd, int priceB, int qty, int tn)
+    {
+        side[slot]=sd;
+        originalQuantity[slot]=qty;
+        priceBid[slot]=priceB;
+        quantity[slot]=qty;
+        turn[slot]=tn;
+        if(peakQuantity[slot]>0)
+        {
+            makeIceberg(slot,peakQuantity[slot]);
+        }
+    }
+    void releaseOrder(int slot)
+    {
+        quantity[slot]=0;
+        peakQuantity[slot]=0;
+        hiddenQuantity[slot]=0;
+        triggerPrice[slot]=0;
+        expiryTime[slot]=0;
+        orderID[slot].clear();
+        freeSlots.push_back(slot);
+    }
+    int slots() const
+    {
+        return (int)priceBid.size();
+    }
+    int freeCount() const
+    {
+        return (int)freeSlots.size();
+    }
+    bool isLive(int slot) const
+    {
+        return quantity[slot]>0;
+    }
+    const string& getOrderID(int slot) const
+    {
+        return orderID[slot];
+    }
+    SideType getSide(int slot) const
+    {
+        return side[slot];
+    }
+    int getPriceBid(int slot) const
+    {
+        return priceBid[slot];
+    }
+    int getQuantity(int slot) const
+    {
+        return quantity[slot];
+    }
+    int getTurn(int slot) const
+    {
+        return turn[slot];
+    }
+    bool isIceberg(int slot) const
+    {
+        return peakQuantity[slot]>0;
+    }
+    bool isStop(int slot) const
+    {
+        return triggerPrice[slot]>0;
+    }
+    int getTriggerPrice(int slot) const
+    {
+        return triggerPrice[slot];
+    }
+    void setTriggerPrice(int slot,int price)
+    {
+        triggerPrice[slot]=price;
+    }
+    unsigned long long getHash(int slot) const
+    {
+        unsigned long long hash=hashMix(idHash[slot]^(unsigned int)priceBid[slot]);
+        hash=hashMix(hash^(((unsigned long long)(unsigned int)quantity[slot]<<1)|(side[slot]==SideType::SELL)));
+        return hashMix(hash^(unsigned int)turn[slot]);
+    }
+    bool hasExpiry(int slot) const
+    {
+        return expiryTime[slot]>0;
+    }
+    long long getExpiryTime(int slot) const
+    {
+        return expiryTime[slot];
+    }
+    void setExpiryTime(int slot,long long expiry)
+    {
+        expiryTime[slot]=expiry;
+    }
+    int getHiddenQuantity(int slot) const
+    {
+        return hiddenQuantity[slot];
+    }
+    int getNext(int slot) const
+    {
+        return next[slot];
+    }
+    void setQuantity(int slot,int qty)
+    {
+        quantity[slot]=qty;
+    }
+    void setTurn(int slot,int tn)
+    {
+        turn[slot]=tn;
+    }
+    friend class QueueHandler;
+};
+
+struct Level
+{
+    int price=0;
+    int head=-1;
+    int tail=-1;
+    int count=0;
+    int icebergs=0;
+    long long quantity=0;
+    unsigned long long hash=0;
+};
+typedef CountedHashMap<int,Level,MemoryAccount::LEVELS> LevelMap;
+
+template<class Side>
+struct Priority
+{
+    bool operator()(const Level* level1, const Level* level2) const
+    {
+        return Side::better(level2->price,level1->price);
+    }
+};
+
+class Stats
+{
 public:
-    Order():orderID(""),orderType(""),executionType(""),priceBid(0),quantity(0),turn(0){};
-    void createOrder(string ordID, string ordType, string execType, int priceB,int qty,int tn)
+    long long inserts[2]={0,0};
+    long long erases[2]={0,0};
+    long long mapLookups=0;
+    long long matchCalls=0;
+    long long matchIterations=0;
+    long long partialFills=0;
+    long long fullFills=0;
+    long long updatesInPlace=0;
+    long long iocKilled=0;
+    long long massCanceled=0;
+    long long ordersExpired=0;
+    long long stopsTriggered=0;
+    long long modifiesInPlace=0;
+    long long icebergRefills=0;
+    long long marketOrders=0;
+    long long levelsSwept=0;
+    long long tombstones=0;
+    long long tombstonesDiscarded=0;
+    long long compactions=0;
+    long long indexSwitches=0;
+    long long peakDepth[2]={0,0};
+    void PrintStats() const
+    {
+        cout<<"STATS: "<<endl;
+        cout<<"BUY_INSERTS "<<inserts[Buy::index]<<endl;
+        cout<<"SELL_INSERTS "<<inserts[Sell::index]<<endl;
+        cout<<"BUY_ERASES "<<erases[Buy::index]<<endl;
+        cout<<"SELL_ERASES "<<erases[Sell::index]<<endl;
+        cout<<"MAP_LOOKUPS "<<mapLookups<<endl;
+        cout<<"MATCH_CALLS "<<matchCalls<<endl;
+        cout<<"MATCH_ITERATIONS "<<matchIterations<<endl;
+        cout<<"PARTIAL_FILLS "<<partialFills<<endl;
+        cout<<"FULL_FILLS "<<fullFills<<endl;
+        cout<<"UPDATES_IN_PLACE "<<updatesInPlace<<endl;
+        cout<<"IOC_KILLED "<<iocKilled<<endl;
+        cout<<"MASS_CANCELED "<<massCanceled<<endl;
+        cout<<"ORDERS_EXPIRED "<<ordersExpired<<endl;
+        cout<<"STOPS_TRIGGERED "<<stopsTriggered<<endl;
+        cout<<"MODIFIES_IN_PLACE "<<modifiesInPlace<<endl;
+        cout<<"ICEBERG_REFILLS "<<icebergRefills<<endl;
+        cout<<"MARKET_ORDERS "<<marketOrders<<endl;
+        cout<<"LEVELS_SWEPT "<<levelsSwept<<endl;
+        cout<<"TOMBSTONES "<<tombstones<<endl;
+        cout<<"TOMBSTONES_DISCARDED "<<tombstonesDiscarded<<endl;
+        cout<<"COMPACTIONS "<<compactions<<endl;
+        cout<<"INDEX_SWITCHES "<<indexSwitches<<endl;
+        cout<<"PEAK_BUY_DEPTH "<<peakDepth[Buy::index]<<endl;
+        cout<<"PEAK_SELL_DEPTH "<<peakDepth[Sell::index]<<endl;
+    }
+};
+
+int findForwardScalar(const long long *levels,int from,int to)
+{
+    for(int i=from;i<to;i++)
+    {
+        if(levels[i]!=0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+int findBackwardScalar(const long long *levels,int from,int to)
+{
+    for(int i=to-1;i>=from;i--)
+    {
+        if(levels[i]!=0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+long long sumLevelsScalar(const long long *levels,int from,int to)
+{
+    long long total=0;
+    for(int i=from;i<to;i++)
     {
-        orderID=ordID;
-        orderType=ordType;
-        executionType=execType;
-        priceBid=priceB;
-        quantity=qty;
-        turn=tn;
+        total+=levels[i];
     }
-    void modifyOrder(string ordType, int priceB, int qty, int tn)
+    return total;
+}
+void subtractLevelsScalar(long long *levels,const long long *amounts,int count)
+{
+    for(int i=0;i<count;i++)
     {
-        orderType=ordType;
-        priceBid=priceB;
-        quantity=qty;
-        turn=tn;
+        levels[i]-=amounts[i];
     }
-    string getOrderID() const
+}
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+int findForwardAVX2(const long long *levels,int from,int to)
+{
+    const __m256i zero=_mm256_setzero_si256();
+    int i=from;
+    for(;i+4<=to;i+=4)
     {
-        return orderID;
+        __m256i empty=_mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(levels+i)),zero);
+        int mask=~_mm256_movemask_pd(_mm256_castsi256_pd(empty))&0xF;
+        if(mask!=0)
+        {
+            return i+__builtin_ctz(mask);
+        }
     }
-    string getOrderType() const
+    return findForwardScalar(levels,i,to);
+}
+__attribute__((target("avx2")))
+int findBackwardAVX2(const long long *levels,int from,int to)
+{
+    const __m256i zero=_mm256_setzero_si256();
+    int i=to;
+    for(;i-4>=from;i-=4)
     {
-        return orderType;
+        __m256i empty=_mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(levels+i-4)),zero);
+        int mask=~_mm256_movemask_pd(_mm256_castsi256_pd(empty))&0xF;
+        if(mask!=0)
+        {
+            return i-4+31-__builtin_clz(mask);
+        }
     }
-    int getPriceBid() const
+    return findBackwardScalar(levels,from,i);
+}
+__attribute__((target("avx2")))
+long long sumLevelsAVX2(const long long *levels,int from,int to)
+{
+    __m256i total=_mm256_setzero_si256();
+    int i=from;
+    for(;i+4<=to;i+=4)
     {
-        return priceBid;
+        total=_mm256_add_epi64(total,_mm256_loadu_si256((const __m256i*)(levels+i)));
     }
-    int getQuantity() const
+    long long lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes,total);
+    return lanes[0]+lanes[1]+lanes[2]+lanes[3]+sumLevelsScalar(levels,i,to);
+}
+__attribute__((target("avx2")))
+void subtractLevelsAVX2(long long *levels,const long long *amounts,int count)
+{
+    int i=0;
+    for(;i+4<=count;i+=4)
     {
-        return quantity;
+        __m256i curr=_mm256_loadu_si256((const __m256i*)(levels+i));
+        __m256i amount=_mm256_loadu_si256((const __m256i*)(amounts+i));
+        _mm256_storeu_si256((__m256i*)(levels+i),_mm256_sub_epi64(curr,amount));
     }
-    int getTurn() const
+    subtractLevelsScalar(levels+i,amounts+i,count-i);
+}
+#endif
+
+struct LadderKernels
+{
+    int (*findForward)(const long long*,int,int);
+    int (*findBackward)(const long long*,int,int);
+    long long (*sumLevels)(const long long*,int,int);
+    void (*subtractLevels)(long long*,const long long*,int);
+};
+LadderKernels selectLadderKernels()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if(__builtin_cpu_supports("avx2"))
     {
-        return turn;
+        return {findForwardAVX2,findBackwardAVX2,sumLevelsAVX2,subtractLevelsAVX2};
     }
-    void setQuantity(int qty)
+#endif
+    return {findForwardScalar,findBackwardScalar,sumLevelsScalar,subtractLevelsScalar};
+}
+const LadderKernels ladderKernels=selectLadderKernels();
+
+class PriceLadder
+{
+private:
+    CountedVector<long long,MemoryAccount::LADDER> levels;
+    int base=0;
+    long long total=0;
+    bool dense=true;
+    static const int maxSpan=1<<22;
+    static const int maxSweepSpan=1<<16;
+    void grow(int price)
     {
-        quantity=qty;
+        if(levels.empty())
+        {
+            base=price;
+            levels.assign(64,0);
+            return;
+        }
+        long long size=levels.size();
+        if(price<base)
+        {
+            long long newBase=max(1LL,min((long long)price,base-size));
+            if(base+size-newBase>maxSpan)
+            {
+                newBase=price;
+            }
+            if(base+size-newBase>maxSpan)
+            {
+                dense=false;
+                return;
+            }
+            levels.insert(levels.begin(),base-newBase,0);
+            base=newBase;
+        }
+        else
+        {
+            if((long long)price-base+1>maxSpan)
+            {
+                dense=false;
+                return;
+            }
+            levels.resize(min(max((long long)price-base+1,2*size),(long long)maxSpan),0);
+        }
+    }
+public:
+    bool isDense() const
+    {
+        return dense;
+    }
+    int span() const
+    {
+        return (int)levels.size();
+    }
+    void add(int price,int qty)
+    {
+        total+=qty;
+        if(!dense)
+        {
+            return;
+        }
+        if(price<base || price-base>=(int)levels.size())
+        {
+            grow(price);
+            if(!dense)
+            {
+                return;
+            }
+        }
+        levels[price-base]+=qty;
+    }
+    void remove(int price,int qty)
+    {
+        total-=qty;
+        if(total==0)
+        {
+            levels.clear();
+            dense=true;
+            return;
+        }
+        if(dense)
+        {
+            levels[price-base]-=qty;
+        }
+    }
+    void subtract(int fromPrice,const long long *amounts,int count)
+    {
+        total-=ladderKernels.sumLevels(amounts,0,count);
+        if(total==0)
+        {
+            levels.clear();
+            dense=true;
+            return;
+        }
+        if(dense)
+        {
+            ladderKernels.subtractLevels(levels.data()+fromPrice-base,amounts,count);
+        }
+    }
+    void removeLevels(const vector<pair<int,int>> &consumed)
+    {
+        if(consumed.empty())
+        {
+            return;
+        }
+        int lowest=min(consumed.front().first,consumed.back().first);
+        int highest=max(consumed.front().first,consumed.back().first);
+        if(!dense || highest-lowest>=maxSweepSpan)
+        {
+            for(auto &currLevel:consumed)
+            {
+                remove(currLevel.first,currLevel.second);
+            }
+            return;
+        }
+        vector<long long> amounts(highest-lowest+1,0);
+        for(auto &currLevel:consumed)
+        {
+            amounts[currLevel.first-lowest]=currLevel.second;
+        }
+        subtract(lowest,amounts.data(),(int)amounts.size());
+    }
+    long long quantityAt(int price) const
+    {
+        if(price<base || price-base>=(int)levels.size())
+        {
+            return 0;
+        }
+        return levels[price-base];
+    }
+    long long sumRange(int fromPrice,int toPrice) const
+    {
+        int from=max(fromPrice-base,0);
+        int to=min(toPrice-base+1,(int)levels.size());
+        if(from>=to)
+        {
+            return 0;
+        }
+        return ladderKernels.sumLevels(levels.data(),from,to);
+    }
+    int lowest() const
+    {
+        int idx=ladderKernels.findForward(levels.data(),0,(int)levels.size());
+        return idx<0?0:base+idx;
+    }
+    int highest() const
+    {
+        int idx=ladderKernels.findBackward(levels.data(),0,(int)levels.size());
+        return idx<0?0:base+idx;
+    }
+    int above(int price) const
+    {
+        int idx=ladderKernels.findForward(levels.data(),max(price-base+1,0),(int)levels.size());
+        return idx<0?0:base+idx;
+    }
+    int below(int price) const
+    {
+        int idx=ladderKernels.findBackward(levels.data(),0,(int)min((long long)price-base,(long long)levels.size()));
+        return idx<0?0:base+idx;
+    }
+};
+
+class LevelBitmap
+{
+private:
+    static const int layers=6;
+    CountedHashMap<long long,uint64_t,MemoryAccount::LEVEL_INDEX> words[layers];
+    uint64_t word(int layer,long long key) const
+    {
+        auto fitr=words[layer].find(key);
+        return fitr==words[layer].end()?0:fitr->second;
+    }
+public:
+    void add(int price)
+    {
+        long long unit=price;
+        for(int layer=0;layer<layers;layer++)
+        {
+            uint64_t &currWord=words[layer][unit>>6];
+            bool wasEmpty=currWord==0;
+            currWord|=1ULL<<(unit&63);
+            if(!wasEmpty)
+            {
+                return;
+            }
+            unit>>=6;
+        }
+    }
+    void remove(int price)
+    {
+        long long unit=price;
+        for(int layer=0;layer<layers;layer++)
+        {
+            auto fitr=words[layer].find(unit>>6);
+            if(fitr==words[layer].end())
+            {
+                return;
+            }
+            fitr->second&=~(1ULL<<(unit&63));
+            if(fitr->second!=0)
+            {
+                return;
+            }
+            words[layer].erase(fitr);
+            unit>>=6;
+        }
+    }
+    int lowest() const
+    {
+        return above(0);
+    }
+    int highest() const
+    {
+        return below((long long)INT_MAX+1);
+    }
+    int above(int price) const
+    {
+        long long unit=(long long)price+1;
+        for(int layer=0;layer<layers;layer++)
+        {
+            uint64_t currWord=word(layer,unit>>6)&(~0ULL<<(unit&63));
+            if(currWord!=0)
+            {
+                unit=((unit>>6)<<6)|__builtin_ctzll(currWord);
+                for(int lower=layer-1;lower>=0;lower--)
+                {
+                    unit=(unit<<6)|__builtin_ctzll(word(lower,unit));
+                }
+                return (int)unit;
+            }
+            unit=(unit>>6)+1;
+        }
+        return 0;
+    }
+    int below(long long price) const
+    {
+        long long unit=price-1;
+        for(int layer=0;layer<layers && unit>=0;layer++)
+        {
+            uint64_t currWord=word(layer,unit>>6)&(~0ULL>>(63-(unit&63)));
+            if(currWord!=0)
+            {
+                unit=((unit>>6)<<6)|(63-__builtin_clzll(currWord));
+                for(int lower=layer-1;lower>=0;lower--)
+                {
+                    unit=(unit<<6)|(63-__builtin_clzll(word(lower,unit)));
+                }
+                return (int)unit;
+            }
+            unit=(unit>>6)-1;
+        }
+        return 0;
+    }
+};
+
+class QueueHandler
+{
+private:
+    priority_queue<Level*,CountedVector<Level*,MemoryAccount::LEVEL_INDEX>,Priority<Buy>> buyPriority;
+    priority_queue<Level*,CountedVector<Level*,MemoryAccount::LEVEL_INDEX>,Priority<Sell>> sellPriority;
+    LevelMap levels[2];
+    PriceLadder ladders[2];
+    long long orderCount[2]={0,0};
+    long long deadLevels[2]={0,0};
+    bool lazyDelete=true;
+    static constexpr double maxDeadRatio=0.5;
+    static const int minCompactLevels=64;
+    Level *best[2]={nullptr,nullptr};
+    bool bestValid[2]={true,true};
+    unsigned long long bookHash=0;
+    IndexMode indexMode=IndexMode::AUTO;
+    bool directIndex[2]={false,false};
+    LevelBitmap bitmaps[2];
+    static const int minLadderLevels=32;
+    static const int maxLadderGap=64;
+    OrderArena &arena;
+    Stats &stats;
+public:
+    QueueHandler(OrderArena &ar,Stats &st):arena(ar),stats(st){};
+    template<class Side>
+    auto& queue()
+    {
+        if constexpr(Side::type==SideType::BUY)
+        {
+            return buyPriority;
+        }
+        else
+        {
+            return sellPriority;
+        }
+    }
+    template<class Side>
+    PriceLadder& ladder()
+    {
+        return ladders[Side::index];
+    }
+    template<class Side>
+    LevelMap& levelMap()
+    {
+        return levels[Side::index];
+    }
+    template<class Side>
+    Level& topLevel()
+    {
+        if(directIndex[Side::index])
+        {
+            return *best[Side::index];
+        }
+        return *queue<Side>().top();
+    }
+    template<class Side>
+    void popLevel()
+    {
+        if(directIndex[Side::index])
+        {
+            best[Side::index]=nextLevel<Side>(topLevel<Side>().price);
+            bestValid[Side::index]=true;
+            return;
+        }
+        queue<Side>().pop();
+    }
+    template<class Side>
+    void discardTombstones()
+    {
+        auto &currQueue=queue<Side>();
+        while(deadLevels[Side::index]>0 && !currQueue.empty() && topLevel<Side>().count==0)
+        {
+            int price=topLevel<Side>().price;
+            popLevel<Side>();
+            levelMap<Side>().erase(price);
+            deadLevels[Side::index]--;
+            stats.erases[Side::index]++;
+            stats.tombstonesDiscarded++;
+        }
+    }
+    template<class Side>
+    Level& bestLevel()
+    {
+        discardTombstones<Side>();
+        return topLevel<Side>();
+    }
+    template<class Side>
+    const Level* cachedBest()
+    {
+        if(!bestValid[Side::index])
+        {
+            best[Side::index]=empty<Side>()?nullptr:&bestLevel<Side>();
+            bestValid[Side::index]=true;
+        }
+        return best[Side::index];
+    }
+    template<class Side>
+    int top()
+    {
+        return bestLevel<Side>().head;
+    }
+    template<class Side>
+    bool empty()
+    {
+        if(directIndex[Side::index])
+        {
+            return levelMap<Side>().empty();
+        }
+        discardTombstones<Side>();
+        return queue<Side>().empty();
+    }
+    void setLazyDelete(bool lazy)
+    {
+        lazyDelete=lazy;
+        if(!lazy)
+        {
+            compact<Buy>();
+            compact<Sell>();
+        }
+    }
+    void setIndexMode(IndexMode mode)
+    {
+        indexMode=mode;
+    }
+    template<class Side>
+    bool isDirect() const
+    {
+        return directIndex[Side::index];
+    }
+    template<class Side>
+    const LevelBitmap& bitmap() const
+    {
+        return bitmaps[Side::index];
+    }
+    template<class Side>
+    bool scanLadder()
+    {
+        PriceLadder &sideLadder=ladder<Side>();
+        if(indexMode==IndexMode::BITMAP || !sideLadder.isDense())
+        {
+            return false;
+        }
+        return indexMode==IndexMode::LADDER || sideLadder.span()<=(long long)levelMap<Side>().size()*maxLadderGap;
+    }
+    template<class Side>
+    Level* nextLevel(int price)
+    {
+        int nextPrice;
+        if(scanLadder<Side>())
+        {
+            nextPrice=Side::type==SideType::BUY?ladder<Side>().below(price):ladder<Side>().above(price);
+        }
+        else
+        {
+            nextPrice=Side::type==SideType::BUY?bitmaps[Side::index].below(price):bitmaps[Side::index].above(price);
+        }
+        return nextPrice==0?nullptr:&levelMap<Side>().find(nextPrice)->second;
+    }
+    template<class Side>
+    Level* firstLevel()
+    {
+        int firstPrice;
+        if(scanLadder<Side>())
+        {
+            firstPrice=Side::type==SideType::BUY?ladder<Side>().highest():ladder<Side>().lowest();
+        }
+        else
+        {
+            firstPrice=Side::type==SideType::BUY?bitmaps[Side::index].highest():bitmaps[Side::index].lowest();
+        }
+        return firstPrice==0?nullptr:&levelMap<Side>().find(firstPrice)->second;
+    }
+    template<class Side>
+    void adapt()
+    {
+        bool indexed=directIndex[Side::index];
+        bool wanted=indexMode!=IndexMode::NATIVE;
+        if(indexMode==IndexMode::AUTO)
+        {
+            long long liveLevels=(long long)levelMap<Side>().size()-deadLevels[Side::index];
+            wanted=liveLevels*(indexed?2:1)>=minLadderLevels;
+        }
+        if(wanted && !indexed)
+        {
+            indexDirect<Side>();
+        }
+        else if(!wanted && indexed)
+        {
+            indexWithSet<Side>();
+        }
+    }
+    template<class Side>
+    void indexDirect()
+    {
+        compact<Side>();
+        queue<Side>()={};
+        for(auto &currLevel:levelMap<Side>())
+        {
+            bitmaps[Side::index].add(currLevel.first);
+        }
+        directIndex[Side::index]=true;
+        best[Side::index]=firstLevel<Side>();
+        bestValid[Side::index]=true;
+        stats.indexSwitches++;
+    }
+    template<class Side>
+    void indexWithSet()
+    {
+        auto &currQueue=queue<Side>();
+        for(auto &currLevel:levelMap<Side>())
+        {
+            currQueue.push(&currLevel.second);
+        }
+        bitmaps[Side::index]=LevelBitmap();
+        directIndex[Side::index]=false;
+        stats.indexSwitches++;
+    }
+    void toggleHash(Level &level,int slot)
+    {
+        unsigned long long hash=arena.getHash(slot);
+        level.hash^=hash;
+        bookHash^=hash;
+    }
+    unsigned long long getBookHash() const
+    {
+        return bookHash;
+    }
+    void linkBack(Level &level,int slot)
+    {
+        arena.prev[slot]=level.tail;
+        arena.next[slot]=-1;
+        if(level.tail>=0)
+        {
+            arena.next[level.tail]=slot;
+        }
+        else
+        {
+            level.head=slot;
+        }
+        level.tail=slot;
+    }
+    void unlink(Level &level,int slot)
+    {
+        int prevSlot=arena.prev[slot];
+        int nextSlot=arena.next[slot];
+        if(prevSlot>=0)
+        {
+            arena.next[prevSlot]=nextSlot;
+        }
+        else
+        {
+            level.head=nextSlot;
+        }
+        if(nextSlot>=0)
+        {
+            arena.prev[nextSlot]=prevSlot;
+        }
+        else
+        {
+            level.tail=prevSlot;
+        }
+    }
+    template<class Side>
+    void addToQueue(int slot)
+    {
+        int price=arena.priceBid[slot];
+        auto res=levelMap<Side>().try_emplace(price);
+        Level &level=res.first->second;
+        if(res.second)
+        {
+            level.price=price;
+            if(directIndex[Side::index])
+            {
+                bitmaps[Side::index].add(price);
+            }
+            else
+            {
+                queue<Side>().push(&level);
+            }
+            stats.inserts[Side::index]++;
+        }
+        else if(level.count==0)
+        {
+            deadLevels[Side::index]--;
+        }
+        linkBack(level,slot);
+        toggleHash(level,slot);
+        level.count++;
+        level.icebergs+=arena.isIceberg(slot);
+        level.quantity+=arena.quantity[slot];
+        ladder<Side>().add(price,arena.quantity[slot]);
+        if(bestValid[Side::index] && (best[Side::index]==nullptr || Side::better(price,best[Side::index]->price)))
+        {
+            best[Side::index]=&level;
+        }
+        orderCount[Side::index]++;
+        stats.peakDepth[Side::index]=max(stats.peakDepth[Side::index],orderCount[Side::index]);
+    }
+    void deleteFromQueue(int slot)
+    {
+        if(arena.side[slot]==SideType::BUY)
+        {
+            Delete<Buy>(slot);
+        }
+        else
+        {
+            Delete<Sell>(slot);
+        }
+    }
+    template<class Side>
+    void Delete(int slot)
+    {
+        auto litr=levelMap<Side>().find(arena.priceBid[slot]);
+        Level &level=litr->second;
+        detach<Side>(level,slot);
+        ladder<Side>().remove(level.price,arena.quantity[slot]);
+        if(level.count==0)
+        {
+            dropLevel<Side>(litr);
+            checkCompact<Side>();
+        }
+    }
+    template<class Side>
+    vector<pair<int,long long>> DeleteBatch(const vector<int> &slots)
+    {
+        unordered_map<int,long long> removed;
+        vector<int> touched;
+        for(int slot:slots)
+        {
+            int price=arena.priceBid[slot];
+            detach<Side>(levelMap<Side>().find(price)->second,slot);
+            auto res=removed.try_emplace(price,0);
+            if(res.second)
+            {
+                touched.push_back(price);
+            }
+            res.first->second+=arena.quantity[slot];
+        }
+        sort(touched.begin(),touched.end(),[](int price1,int price2){return Side::better(price1,price2);});
+        vector<pair<int,long long>> depth;
+        for(int price:touched)
+        {
+            ladder<Side>().remove(price,removed[price]);
+            auto litr=levelMap<Side>().find(price);
+            depth.push_back({price,litr->second.quantity});
+            if(litr->second.count==0)
+            {
+                dropLevel<Side>(litr);
+            }
+        }
+        checkCompact<Side>();
+        return depth;
+    }
+    template<class Side>
+    void detach(Level &level,int slot)
+    {
+        unlink(level,slot);
+        toggleHash(level,slot);
+        level.count--;
+        level.icebergs-=arena.isIceberg(slot);
+        level.quantity-=arena.quantity[slot];
+        orderCount[Side::index]--;
+    }
+    template<class Side>
+    void dropLevel(LevelMap::iterator litr)
+    {
+        if(directIndex[Side::index])
+        {
+            bitmaps[Side::index].remove(litr->first);
+            if(best[Side::index]==&litr->second)
+            {
+                best[Side::index]=nextLevel<Side>(litr->first);
+            }
+            levelMap<Side>().erase(litr);
+            stats.erases[Side::index]++;
+            return;
+        }
+        if(best[Side::index]==&litr->second)
+        {
+            bestValid[Side::index]=false;
+        }
+        if(lazyDelete)
+        {
+            deadLevels[Side::index]++;
+            stats.tombstones++;
+        }
+        else
+        {
+            eraseLevel<Side>(litr->second);
+            levelMap<Side>().erase(litr);
+            stats.erases[Side::index]++;
+        }
+    }
+    template<class Side>
+    void checkCompact()
+    {
+        size_t levelsInQueue=queue<Side>().size();
+        if(lazyDelete && levelsInQueue>=minCompactLevels && deadLevels[Side::index]>maxDeadRatio*levelsInQueue)
+        {
+            compact<Side>();
+        }
+    }
+    template<class Side>
+    void eraseLevel(Level &level)
+    {
+        auto &currQueue=queue<Side>();
+        vector<Level*> temp;
+        while(!currQueue.empty())
+        {
+            if(&level!=currQueue.top())
+            {
+                temp.push_back(currQueue.top());
+                currQueue.pop();
+            }
+            else
+            {
+                currQueue.pop();
+                break;
+            }
+        }
+        for(Level* currLevel:temp)
+        {
+            currQueue.push(currLevel);
+        }
+    }
+    template<class Side>
+    void removeEmptyLevels()
+    {
+        auto &currQueue=queue<Side>();
+        CountedVector<Level*,MemoryAccount::LEVEL_INDEX> temp;
+        while(!currQueue.empty())
+        {
+            if(currQueue.top()->count>0)
+            {
+                temp.push_back(currQueue.top());
+            }
+            currQueue.pop();
+        }
+        currQueue=priority_queue<Level*,CountedVector<Level*,MemoryAccount::LEVEL_INDEX>,Priority<Side>>(Priority<Side>(),move(temp));
+    }
+    template<class Side>
+    void compact()
+    {
+        if(deadLevels[Side::index]==0)
+        {
+            return;
+        }
+        removeEmptyLevels<Side>();
+        auto &sideLevels=levelMap<Side>();
+        for(auto itr=sideLevels.begin();itr!=sideLevels.end();)
+        {
+            if(itr->second.count==0)
+            {
+                itr=sideLevels.erase(itr);
+            }
+            else
+            {
+                itr++;
+            }
+        }
+        stats.erases[Side::index]+=deadLevels[Side::index];
+        deadLevels[Side::index]=0;
+        stats.compactions++;
+    }
+    template<class Side>
+    void dropBestLevel()
+    {
+        Level &level=bestLevel<Side>();
+        int price=level.price;
+        orderCount[Side::index]-=level.count;
+        bookHash^=level.hash;
+        bestValid[Side::index]=false;
+        popLevel<Side>();
+        if(directIndex[Side::index])
+        {
+            bitmaps[Side::index].remove(price);
+        }
+        levelMap<Side>().erase(price);
+        stats.erases[Side::index]++;
+    }
+    template<class Side>
+    void requeue(int slot,int newQuantity)
+    {
+        Level &level=levelMap<Side>().find(arena.priceBid[slot])->second;
+        if(level.tail!=slot)
+        {
+            unlink(level,slot);
+            linkBack(level,slot);
+        }
+        changeQuantity<Side>(slot,newQuantity);
+    }
+    template<class Side>
+    void changeQuantity(int slot,int newQuantity)
+    {
+        Level &level=levelMap<Side>().find(arena.priceBid[slot])->second;
+        int oldQuantity=arena.quantity[slot];
+        toggleHash(level,slot);
+        level.quantity+=newQuantity-oldQuantity;
+        if(newQuantity<oldQuantity)
+        {
+            ladder<Side>().remove(level.price,oldQuantity-newQuantity);
+        }
+        else
+        {
+            ladder<Side>().add(level.price,newQuantity-oldQuantity);
+        }
+        arena.quantity[slot]=newQuantity;
+        toggleHash(level,slot);
+    }
+    friend class OrderBook;
+};
+
+template<class Side>
+struct StopPriority
+{
+    bool operator()(const pair<int,int> &stop1,const pair<int,int> &stop2) const
+    {
+        if(stop1.first!=stop2.first)
+        {
+            return Side::Opposite::better(stop1.first,stop2.first);
+        }
+        return stop1.second<stop2.second;
+    }
+};
+
+class StopBook
+{
+private:
+    map<pair<int,int>,int,StopPriority<Buy>,CountingAllocator<pair<const pair<int,int>,int>,MemoryAccount::STOPS>> buyStops;
+    map<pair<int,int>,int,StopPriority<Sell>,CountingAllocator<pair<const pair<int,int>,int>,MemoryAccount::STOPS>> sellStops;
+    OrderArena &arena;
+public:
+    StopBook(OrderArena &ar):arena(ar){};
+    template<class Side>
+    auto& stops()
+    {
+        if constexpr(Side::type==SideType::BUY)
+        {
+            return buyStops;
+        }
+        else
+        {
+            return sellStops;
+        }
+    }
+    template<class Side>
+    void add(int slot)
+    {
+        stops<Side>().emplace(make_pair(arena.getTriggerPrice(slot),arena.getTurn(slot)),slot);
+    }
+    void remove(int slot)
+    {
+        pair<int,int> key(arena.getTriggerPrice(slot),arena.getTurn(slot));
+        if(arena.getSide(slot)==SideType::BUY)
+        {
+            buyStops.erase(key);
+        }
+        else
+        {
+            sellStops.erase(key);
+        }
+    }
+    template<class Side>
+    void popTriggered(int lastPrice,vector<int> &triggered)
+    {
+        auto &sideStops=stops<Side>();
+        auto itr=sideStops.begin();
+        while(itr!=sideStops.end() && Side::crosses(lastPrice,itr->first.first))
+        {
+            triggered.push_back(itr->second);
+            arena.setTriggerPrice(itr->second,0);
+            itr=sideStops.erase(itr);
+        }
+    }
+};
+
+class TimingWheel
+{
+private:
+    static const int wheelLevels=4;
+    int buckets[wheelLevels*64];
+    uint64_t occupied[wheelLevels]={0,0,0,0};
+    CountedVector<int,MemoryAccount::EXPIRIES> next;
+    CountedVector<int,MemoryAccount::EXPIRIES> prev;
+    CountedVector<int,MemoryAccount::EXPIRIES> bucketOf;
+    long long now=0;
+    long long count=0;
+    OrderArena &arena;
+    void link(int slot)
+    {
+        long long expiry=arena.getExpiryTime(slot);
+        long long delta=max(expiry-now,0LL);
+        int level=0;
+        while(level<wheelLevels-1 && delta>=(1LL<<(6*(level+1))))
+        {
+            level++;
+        }
+        if(delta>=(1LL<<(6*wheelLevels)))
+        {
+            expiry=now+(1LL<<(6*wheelLevels))-1;
+        }
+        int idx=(int)((expiry>>(6*level))&63);
+        int bucket=level*64+idx;
+        prev[slot]=-1;
+        next[slot]=buckets[bucket];
+        if(buckets[bucket]>=0)
+        {
+            prev[buckets[bucket]]=slot;
+        }
+        buckets[bucket]=slot;
+        bucketOf[slot]=bucket;
+        occupied[level]|=1ULL<<idx;
+    }
+    void unlink(int slot)
+    {
+        int bucket=bucketOf[slot];
+        if(prev[slot]>=0)
+        {
+            next[prev[slot]]=next[slot];
+        }
+        else
+        {
+            buckets[bucket]=next[slot];
+        }
+        if(next[slot]>=0)
+        {
+            prev[next[slot]]=prev[slot];
+        }
+        if(buckets[bucket]<0)
+        {
+            occupied[bucket/64]&=~(1ULL<<(bucket%64));
+        }
+        bucketOf[slot]=-1;
+    }
+    void drain(int bucket,vector<int> &out)
+    {
+        while(buckets[bucket]>=0)
+        {
+            int slot=buckets[bucket];
+            unlink(slot);
+            out.push_back(slot);
+        }
+    }
+public:
+    TimingWheel(OrderArena &ar):arena(ar)
+    {
+        fill(begin(buckets),end(buckets),-1);
+    }
+    long long getNow() const
+    {
+        return now;
+    }
+    void add(int slot)
+    {
+        if(slot>=(int)bucketOf.size())
+        {
+            next.resize(slot+1,-1);
+            prev.resize(slot+1,-1);
+            bucketOf.resize(slot+1,-1);
+        }
+        link(slot);
+        count++;
+    }
+    void remove(int slot)
+    {
+        if(slot<(int)bucketOf.size() && bucketOf[slot]>=0)
+        {
+            unlink(slot);
+            count--;
+        }
+    }
+    void advance(long long to,vector<int> &expired)
+    {
+        vector<int> cascaded;
+        while(now<to)
+        {
+            if(count==0)
+            {
+                now=to;
+                break;
+            }
+            long long step=1;
+            for(int level=0;level<wheelLevels && occupied[level]==0;level++)
+            {
+                step<<=6;
+            }
+            now=min((now/step+1)*step,to);
+            for(int level=wheelLevels-1;level>0;level--)
+            {
+                if(now%(1LL<<(6*level))==0)
+                {
+                    cascaded.clear();
+                    drain(level*64+(int)((now>>(6*level))&63),cascaded);
+                    for(int slot:cascaded)
+                    {
+                        link(slot);
+                    }
+                }
+            }
+            int before=(int)expired.size();
+            drain((int)(now&63),expired);
+            count-=(int)expired.size()-before;
+        }
+    }
+};
+
+class OrderIndex
+{
+private:
+    static const long long windowSize=1<<20;
+    long long base=-1;
+    CountedVector<int,MemoryAccount::ORDER_WINDOW> ring;
+    CountedVector<uint64_t,MemoryAccount::ORDER_WINDOW> occupied;
+    long long live=0;
+    long long lowest=0;
+    CountedHashMap<string,int,MemoryAccount::ORDER_MAP> fallback;
+    static long long numericID(const string &orderID)
+    {
+        if(orderID.empty() || orderID.size()>18 || (orderID[0]=='0' && orderID.size()>1))
+        {
+            return -1;
+        }
+        long long value=0;
+        for(char c:orderID)
+        {
+            if(c<'0' || c>'9')
+            {
+                return -1;
+            }
+            value=value*10+(c-'0');
+        }
+        return value;
+    }
+    bool inWindow(long long value) const
+    {
+        return base>=0 && value>=base && value<base+windowSize;
+    }
+    void mark(long long value,bool used)
+    {
+        long long position=value&(windowSize-1);
+        uint64_t bit=1ULL<<(position&63);
+        if(used)
+        {
+            occupied[position>>6]|=bit;
+        }
+        else
+        {
+            occupied[position>>6]&=~bit;
+        }
+        live+=used?1:-1;
+    }
+    void slide(long long value)
+    {
+        long long newBase=value-windowSize+1;
+        long long end=min(newBase,base+windowSize);
+        long long id=max(base,lowest);
+        while(id<end && live>0)
+        {
+            uint64_t bits=occupied[(id&(windowSize-1))>>6]&(~0ULL<<(id&63));
+            if(bits==0)
+            {
+                id=(id|63)+1;
+                continue;
+            }
+            id=(id&~63LL)|__builtin_ctzll(bits);
+            if(id>=end)
+            {
+                break;
+            }
+            int &slot=ring[id&(windowSize-1)];
+            fallback.emplace(to_string(id),slot);
+            slot=-1;
+            mark(id,false);
+            id++;
+        }
+        base=newBase;
+        lowest=max(id,newBase);
+    }
+public:
+    int find(const string &orderID) const
+    {
+        long long value=numericID(orderID);
+        if(inWindow(value))
+        {
+            return ring[value&(windowSize-1)];
+        }
+        auto fitr=fallback.find(orderID);
+        return fitr==fallback.end()?-1:fitr->second;
+    }
+    void insert(const string &orderID,int slot)
+    {
+        long long value=numericID(orderID);
+        if(value>=0 && base<0)
+        {
+            ring.assign(windowSize,-1);
+            occupied.assign(windowSize/64,0);
+            base=value;
+        }
+        if(value>=base+windowSize)
+        {
+            slide(value);
+        }
+        if(inWindow(value))
+        {
+            ring[value&(windowSize-1)]=slot;
+            lowest=live==0?value:min(lowest,value);
+            mark(value,true);
+        }
+        else
+        {
+            fallback.emplace(orderID,slot);
+        }
+    }
+    void erase(const string &orderID)
+    {
+        long long value=numericID(orderID);
+        if(inWindow(value))
+        {
+            int &slot=ring[value&(windowSize-1)];
+            if(slot>=0)
+            {
+                slot=-1;
+                mark(value,false);
+            }
+        }
+        else
+        {
+            fallback.erase(orderID);
+        }
+    }
+    void prefetch(const string &orderID) const
+    {
+        long long value=numericID(orderID);
+        if(inWindow(value))
+        {
+            __builtin_prefetch(&ring[value&(windowSize-1)]);
+            return;
+        }
+        auto bitr=fallback.begin(fallback.bucket(orderID));
+        if(bitr!=fallback.end(fallback.bucket(orderID)))
+        {
+            __builtin_prefetch(&*bitr);
+        }
+    }
+};
+
+class OwnerLists
+{
+private:
+    CountedHashMap<string,int,MemoryAccount::OWNERS> ownerIndex;
+    CountedVector<int,MemoryAccount::OWNERS> heads;
+    CountedVector<int,MemoryAccount::OWNERS> next;
+    CountedVector<int,MemoryAccount::OWNERS> prev;
+    CountedVector<int,MemoryAccount::OWNERS> ownerOf;
+public:
+    void add(int slot,const string &owner)
+    {
+        auto res=ownerIndex.try_emplace(owner,(int)heads.size());
+        if(res.second)
+        {
+            heads.push_back(-1);
+        }
+        if(slot>=(int)ownerOf.size())
+        {
+            next.resize(slot+1,-1);
+            prev.resize(slot+1,-1);
+            ownerOf.resize(slot+1,-1);
+        }
+        int idx=res.first->second;
+        prev[slot]=-1;
+        next[slot]=heads[idx];
+        if(heads[idx]>=0)
+        {
+            prev[heads[idx]]=slot;
+        }
+        heads[idx]=slot;
+        ownerOf[slot]=idx;
+    }
+    void remove(int slot)
+    {
+        if(slot>=(int)ownerOf.size() || ownerOf[slot]<0)
+        {
+            return;
+        }
+        if(prev[slot]>=0)
+        {
+            next[prev[slot]]=next[slot];
+        }
+        else
+        {
+            heads[ownerOf[slot]]=next[slot];
+        }
+        if(next[slot]>=0)
+        {
+            prev[next[slot]]=prev[slot];
+        }
+        ownerOf[slot]=-1;
+    }
+    vector<int> take(const string &owner)
+    {
+        vector<int> slots;
+        auto fitr=ownerIndex.find(owner);
+        if(fitr==ownerIndex.end())
+        {
+            return slots;
+        }
+        for(int slot=heads[fitr->second];slot>=0;slot=next[slot])
+        {
+            slots.push_back(slot);
+            ownerOf[slot]=-1;
+        }
+        heads[fitr->second]=-1;
+        return slots;
+    }
+};
+
+void allocateProRata(const int *quantity,int *fill,int n,long long amount)
+{
+    long long total=0;
+    for(int i=0;i<n;i++)
+    {
+        total+=quantity[i]-fill[i];
+    }
+    if(total<=amount)
+    {
+        copy(quantity,quantity+n,fill);
+        return;
+    }
+    long long given=0;
+    for(int i=0;i<n;i++)
+    {
+        int share=(int)((long long)(quantity[i]-fill[i])*amount/total);
+        fill[i]+=share;
+        given+=share;
+    }
+    for(int i=0;i<n && given<amount;i++)
+    {
+        if(fill[i]<quantity[i])
+        {
+            fill[i]++;
+            given++;
+        }
+    }
+}
+
+class TradeAnalytics
+{
+private:
+    long long trades=0;
+    long long volume=0;
+    long long notional=0;
+    CountedHashMap<int,long long,MemoryAccount::ANALYTICS> levelVolume;
+    enum class BarMode {NONE, TIME, VOLUME} barMode=BarMode::NONE;
+    long long barSize=0;
+    long long barIndex=0;
+    int open=0;
+    int high=0;
+    int low=0;
+    int close=0;
+    long long barVolume=0;
+    void closeBar()
+    {
+        if(barVolume>0)
+        {
+            cout<<"BAR "<<open<<" "<<high<<" "<<low<<" "<<close<<" "<<barVolume<<endl;
+        }
+        barVolume=0;
+    }
+public:
+    void setBars(const string &mode,long long size)
+    {
+        closeBar();
+        barSize=size;
+        barMode=BarMode::NONE;
+        if(size>0 && mode=="TIME")
+        {
+            barMode=BarMode::TIME;
+        }
+        else if(size>0 && mode=="VOLUME")
+        {
+            barMode=BarMode::VOLUME;
+        }
+    }
+    void onTrade(int price,int qty,long long now)
+    {
+        trades++;
+        volume+=qty;
+        notional+=(long long)price*qty;
+        levelVolume[price]+=qty;
+        if(barMode==BarMode::NONE)
+        {
+            return;
+        }
+        if(barMode==BarMode::TIME)
+        {
+            onTime(now);
+            barIndex=now/barSize;
+        }
+        if(barVolume==0)
+        {
+            open=high=low=price;
+        }
+        high=max(high,price);
+        low=min(low,price);
+        close=price;
+        barVolume+=qty;
+        if(barMode==BarMode::VOLUME && barVolume>=barSize)
+        {
+            closeBar();
+        }
+    }
+    void onTime(long long now)
+    {
+        if(barMode==BarMode::TIME && barVolume>0 && now/barSize!=barIndex)
+        {
+            closeBar();
+        }
+    }
+    void print()
+    {
+        ostringstream vwap;
+        vwap<<fixed<<setprecision(4)<<(volume>0?(double)notional/volume:0.0);
+        cout<<"ANALYTICS "<<trades<<" "<<volume<<" "<<vwap.str()<<endl;
+        if(barVolume>0)
+        {
+            cout<<"OPEN_BAR "<<open<<" "<<high<<" "<<low<<" "<<close<<" "<<barVolume<<endl;
+        }
+        map<int,long long,greater<int>> temp(levelVolume.begin(),levelVolume.end());
+        for(auto &level:temp)
+        {
+            cout<<"VOLUME "<<level.first<<" "<<level.second<<endl;
+        }
+    }
+};
+
+struct BookState
+{
+    static const int depth=10;
+    long long events;
+    int levels[2];
+    int prices[2][depth];
+    long long quantities[2][depth];
+};
+
+struct SharedBook
+{
+    atomic<unsigned long long> sequence;
+    BookState state;
+};
+
+class BookPublisher
+{
+private:
+    SharedBook *book=nullptr;
+    static SharedBook* mapRegion(const string &name,bool create)
+    {
+        int fd=shm_open(name.c_str(),create?O_CREAT|O_RDWR:O_RDONLY,0644);
+        if(fd<0)
+        {
+            return nullptr;
+        }
+        if(create && ftruncate(fd,sizeof(SharedBook))!=0)
+        {
+            close(fd);
+            return nullptr;
+        }
+        void *addr=mmap(nullptr,sizeof(SharedBook),create?PROT_READ|PROT_WRITE:PROT_READ,MAP_SHARED,fd,0);
+        close(fd);
+        return addr==MAP_FAILED?nullptr:static_cast<SharedBook*>(addr);
+    }
+public:
+    BookPublisher()=default;
+    BookPublisher(const BookPublisher&)=delete;
+    BookPublisher& operator=(const BookPublisher&)=delete;
+    ~BookPublisher()
+    {
+        if(book)
+        {
+            munmap(book,sizeof(SharedBook));
+        }
+    }
+    bool open(const string &name)
+    {
+        book=mapRegion(name,true);
+        if(book)
+        {
+            book->sequence.store(0,memory_order_relaxed);
+            book->state=BookState();
+        }
+        return book!=nullptr;
+    }
+    bool isOpen() const
+    {
+        return book!=nullptr;
+    }
+    void publish(const vector<pair<int,long long>> (&depth)[2])
+    {
+        unsigned long long seq=book->sequence.load(memory_order_relaxed);
+        book->sequence.store(seq+1,memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        BookState &state=book->state;
+        state.events++;
+        for(int sd=0;sd<2;sd++)
+        {
+            state.levels[sd]=(int)min(depth[sd].size(),(size_t)BookState::depth);
+            for(int i=0;i<state.levels[sd];i++)
+            {
+                state.prices[sd][i]=depth[sd][i].first;
+                state.quantities[sd][i]=depth[sd][i].second;
+            }
+        }
+        book->sequence.store(seq+2,memory_order_release);
+    }
+    static bool read(const string &name,BookState &state)
+    {
+        SharedBook *shared=mapRegion(name,false);
+        if(!shared)
+        {
+            return false;
+        }
+        unsigned long long before,after;
+        do
+        {
+            before=shared->sequence.load(memory_order_acquire);
+            state=shared->state;
+            atomic_thread_fence(memory_order_acquire);
+            after=shared->sequence.load(memory_order_relaxed);
+        }
+        while((before&1) || before!=after);
+        munmap(shared,sizeof(SharedBook));
+        return true;
+    }
+};
+
+class OrderBook
+{
+private:
+    OrderIndex orderMap;
+    OrderArena arena;
+    int turn=0;
+    Stats stats;
+    QueueHandler QH{arena,stats};
+    StopBook stops{arena};
+    int lastTradePrice=0;
+    bool triggering=false;
+    TimingWheel timers{arena};
+    OwnerLists owners;
+    AllocationPolicy policy=AllocationPolicy::FIFO;
+    int splitPercent=40;
+    TradeAnalytics analytics;
+    BookPublisher publisher;
+    int snapshots=0;
+    static const int adaptInterval=1024;
+    int sinceAdapt=0;
+    vector<int> allocSlots;
+    vector<int> allocQuantity;
+    vector<int> allocFill;
+    long long memoryBudget=0;
+    long long memoryRejected=0;
+    
+public:
+    bool InsertOrder(string orderType,string executionType,int priceBid,int quantity,string orderID,long long extra=0,const string &owner="")
+    {
+        if(orderID!="" && quantity>0 && executionType=="MARKET")
+        {
+            if(orderType=="BUY")
+            {
+                InsertOrderMarket<Buy>(orderID,quantity);
+                return true;
+            }
+            else if(orderType=="SELL")
+            {
+                InsertOrderMarket<Sell>(orderID,quantity);
+                return true;
+            }
+        }
+        else if(orderID!="" && priceBid>0 && quantity>0 && (executionType=="STOP"||(executionType=="STOPLIMIT"&&extra>0)))
+        {
+            if(!WithinBudget(orderID))
+            {
+                return false;
+            }
+            int limitPrice=executionType=="STOP"?0:(int)extra;
+            if(orderType=="BUY")
+            {
+                return InsertOrderStop<Buy>(executionType,priceBid,limitPrice,quantity,orderID,owner);
+            }
+            else if(orderType=="SELL")
+            {
+                return InsertOrderStop<Sell>(executionType,priceBid,limitPrice,quantity,orderID,owner);
+            }
+        }
+        else if(orderID!="" && priceBid>0 && quantity>0 && (executionType=="IOC"||executionType=="GFD"||(executionType=="ICEBERG"&&extra>0)||(executionType=="GTT"&&extra>timers.getNow())))
+        {
+            if(executionType!="IOC" && !WithinBudget(orderID))
+            {
+                return false;
+            }
+            if(orderType=="BUY")
+            {
+                return InsertOrder<Buy>(executionType,priceBid,quantity,orderID,extra,owner);
+            }
+            else if(orderType=="SELL")
+            {
+                return InsertOrder<Sell>(executionType,priceBid,quantity,orderID,extra,owner);
+            }
+        }
+        return false;
+    }
+    bool WithinBudget(const string &orderID)
+    {
+        if(memoryBudget==0 || memoryUsage.variable()<=memoryBudget)
+        {
+            return true;
+        }
+        memoryRejected++;
+        cout<<"REJECT "<<orderID<<" MEMORY"<<endl;
+        return false;
+    }
+    template<class Side>
+    bool InsertOrder(const string &executionType,int priceBid,int quantity,const string &orderID,long long extra,const string &owner)
+    {
+        stats.mapLookups++;
+        if(orderMap.find(orderID)>=0)
+        {
+            return false;
+        }
+        int slot=arena.createOrder(orderID,Side::type,executionType,priceBid,quantity,++turn);
+        orderMap.insert(orderID,slot);
+        if(owner!="")
+        {
+            owners.add(slot,owner);
+        }
+        if(executionType=="GFD")
+        {
+            InsertOrderGFD<Side>(slot);
+        }
+        else if(executionType=="IOC")
+        {
+            InsertOrderIOC<Side>(slot);
+        }
+        else if(executionType=="ICEBERG")
+        {
+            arena.makeIceberg(slot,(int)extra);
+            InsertOrderGFD<Side>(slot);
+        }
+        else if(executionType=="GTT")
+        {
+            arena.setExpiryTime(slot,extra);
+            timers.add(slot);
+            InsertOrderGFD<Side>(slot);
+        }
+        return true;
+    }
+    template<class Side>
+    void InsertOrderGFD(int slot)
+    {
+        QH.addToQueue<Side>(slot);
+        if(Marketable<Side>(arena.getPriceBid(slot)))
+        {
+            Match();
+        }
+    }
+    template<class Side>
+    bool Marketable(int price)
+    {
+        const Level *opposite=QH.cachedBest<typename Side::Opposite>();
+        return opposite!=nullptr && Side::crosses(price,opposite->price);
+    }
+    template<class Side>
+    void InsertOrderIOC(int slot)
+    {
+        int quantity=arena.getQuantity(slot);
+        bool wasTriggering=triggering;
+        triggering=true;
+        QH.addToQueue<Side>(slot);
+        if(slot==QH.top<Side>())
+        {
+            Match();
+        }
+        if(arena.isLive(slot))
+        {
+            if(arena.getQuantity(slot)==quantity)
+            {
+                stats.iocKilled++;
+            }
+            CancelOrder<Side>(slot);
+        }
+        triggering=wasTriggering;
+        TriggerStops();
+    }
+    template<class Side>
+    bool InsertOrderStop(const string &executionType,int triggerPrice,int limitPrice,int quantity,const string &orderID,const string &owner)
+    {
+        stats.mapLookups++;
+        if(orderMap.find(orderID)>=0)
+        {
+            return false;
+        }
+        int slot=arena.createOrder(orderID,Side::type,executionType,limitPrice,quantity,++turn);
+        orderMap.insert(orderID,slot);
+        if(owner!="")
+        {
+            owners.add(slot,owner);
+        }
+        arena.setTriggerPrice(slot,triggerPrice);
+        stops.add<Side>(slot);
+        TriggerStops();
+        return true;
+    }
+    void TriggerStops()
+    {
+        if(triggering)
+        {
+            return;
+        }
+        triggering=true;
+        vector<int> triggered;
+        while(lastTradePrice>0)
+        {
+            triggered.clear();
+            stops.popTriggered<Buy>(lastTradePrice,triggered);
+            stops.popTriggered<Sell>(lastTradePrice,triggered);
+            if(triggered.empty())
+            {
+                break;
+            }
+            sort(triggered.begin(),triggered.end(),[this](int slot1,int slot2){return arena.getTurn(slot1)<arena.getTurn(slot2);});
+            for(int slot:triggered)
+            {
+                stats.stopsTriggered++;
+                if(arena.getSide(slot)==SideType::BUY)
+                {
+                    InjectStop<Buy>(slot);
+                }
+                else
+                {
+                    InjectStop<Sell>(slot);
+                }
+            }
+        }
+        triggering=false;
+    }
+    template<class Side>
+    void InjectStop(int slot)
+    {
+        if(arena.getPriceBid(slot)==0)
+        {
+            string orderID=arena.getOrderID(slot);
+            int quantity=arena.getQuantity(slot);
+            orderMap.erase(orderID);
+            stats.mapLookups++;
+            ReleaseSlot(slot);
+            InsertOrderMarket<Side>(orderID,quantity);
+        }
+        else
+        {
+            arena.setTurn(slot,++turn);
+            InsertOrderGFD<Side>(slot);
+        }
+    }
+    template<class Side>
+    void InsertOrderMarket(const string &orderID,int quantity)
+    {
+        using Opposite=typename Side::Opposite;
+        stats.mapLookups++;
+        if(orderMap.find(orderID)>=0)
+        {
+            return;
+        }
+        ++turn;
+        stats.marketOrders++;
+        int remaining=quantity;
+        long long notional=0;
+        int levels=0;
+        int lastPrice=0;
+        vector<pair<int,int>> consumed;
+        while(remaining>0 && !QH.empty<Opposite>())
+        {
+            Level &level=QH.bestLevel<Opposite>();
+            int price=level.price;
+            if(price!=lastPrice)
+            {
+                levels++;
+                lastPrice=price;
+            }
+            if(remaining>=level.quantity && level.icebergs==0)
+            {
+                for(int slot=level.head;slot>=0;)
+                {
+                    int nextSlot=arena.getNext(slot);
+                    int qty=arena.getQuantity(slot);
+                    PrintFill(slot,orderID,price,qty);
+                    RecordTrade(price,qty);
+                    remaining-=qty;
+                    stats.fullFills++;
+                    CountMarketFill(remaining);
+                    orderMap.erase(arena.getOrderID(slot));
+                    stats.mapLookups++;
+                    ReleaseSlot(slot);
+                    slot=nextSlot;
+                }
+                notional+=(long long)price*level.quantity;
+                consumed.push_back({price,(int)level.quantity});
+                QH.dropBestLevel<Opposite>();
+                stats.levelsSwept++;
+            }
+            else if(policy!=AllocationPolicy::FIFO)
+            {
+                AllocateLevel(level,remaining);
+                for(size_t i=0;i<allocSlots.size();i++)
+                {
+                    int slot=allocSlots[i];
+                    int fillQty=allocFill[i];
+                    if(fillQty==0)
+                    {
+                        continue;
+                    }
+                    PrintFill(slot,orderID,price,fillQty);
+                    RecordTrade(price,fillQty);
+                    remaining-=fillQty;
+                    notional+=(long long)price*fillQty;
+                    CountMarketFill(remaining);
+                    FillResting<Opposite>(slot,fillQty);
+                }
+            }
+            else
+            {
+                int slot=level.head;
+                int qty=arena.getQuantity(slot);
+                int fillQty=min(qty,remaining);
+                PrintFill(slot,orderID,price,fillQty);
+                RecordTrade(price,fillQty);
+                remaining-=fillQty;
+                notional+=(long long)price*fillQty;
+                CountMarketFill(remaining);
+                if(fillQty==qty)
+                {
+                    stats.fullFills++;
+                    OrderFilled<Opposite>(slot);
+                }
+                else
+                {
+                    stats.partialFills++;
+                    UpdateOrder<Opposite>(slot,qty-fillQty);
+                }
+            }
+        }
+        QH.ladder<Opposite>().removeLevels(consumed);
+        cout<<"MARKET "<<orderID<<" "<<quantity-remaining<<" "<<notional<<" "<<levels<<" "<<remaining<<endl;
+        TriggerStops();
+    }
+    bool ModifyOrder(string orderID,string orderType,int priceBid,int quantity)
+    {
+        int slot=orderMap.find(orderID);
+        stats.mapLookups++;
+        if(slot>=0 && !arena.isStop(slot) && priceBid>0 && quantity>0)
+        {
+            if(orderType=="BUY")
+            {
+                ModifyOrder<Buy>(slot,priceBid,quantity);
+                return true;
+            }
+            else if(orderType=="SELL")
+            {
+                ModifyOrder<Sell>(slot,priceBid,quantity);
+                return true;
+            }
+        }
+        return false;
+    }
+    template<class Side>
+    void ModifyOrder(int slot,int priceBid,int quantity)
+    {
+        if(arena.getSide(slot)==Side::type && arena.getPriceBid(slot)==priceBid && quantity<arena.getQuantity(slot) && !arena.isIceberg(slot))
+        {
+            stats.modifiesInPlace++;
+            QH.changeQuantity<Side>(slot,quantity);
+            return;
+        }
+        QH.deleteFromQueue(slot);
+        arena.modifyOrder(slot,Side::type,priceBid,quantity,++turn);
+        QH.addToQueue<Side>(slot);
+        if(Marketable<Side>(priceBid))
+        {
+            Match();
+        }
+    }
+    template<class Side>
+    void UpdateOrder(int slot,int newQuantity)
+     {
+        stats.updatesInPlace++;
+        QH.changeQuantity<Side>(slot,newQuantity);
+     }
+    bool CancelOrder(string orderID)
+    {
+        int slot=orderMap.find(orderID);
+        stats.mapLookups++;
+        if(slot>=0)
+        {
+            if(arena.isStop(slot))
+            {
+                stops.remove(slot);
+            }
+            else
+            {
+                QH.deleteFromQueue(slot);
+            }
+            orderMap.erase(orderID);
+            ReleaseSlot(slot);
+            return true;
+        }
+        return false;
+    }
+    template<class Side>
+    void CancelOrder(int slot)
+    {
+        QH.Delete<Side>(slot);
+        orderMap.erase(arena.getOrderID(slot));
+        stats.mapLookups++;
+        ReleaseSlot(slot);
+    }
+    void ReleaseSlot(int slot)
+    {
+        if(arena.hasExpiry(slot))
+        {
+            timers.remove(slot);
+        }
+        owners.remove(slot);
+        arena.releaseOrder(slot);
+    }
+    void MassCancel(const string &owner)
+    {
+        vector<int> slots=owners.take(owner);
+        vector<int> buySlots,sellSlots;
+        for(int slot:slots)
+        {
+            if(arena.isStop(slot))
+            {
+                stops.remove(slot);
+            }
+            else if(arena.getSide(slot)==SideType::BUY)
+            {
+                buySlots.push_back(slot);
+            }
+            else
+            {
+                sellSlots.push_back(slot);
+            }
+        }
+        PrintDepth("SELL",QH.DeleteBatch<Sell>(sellSlots));
+        PrintDepth("BUY",QH.DeleteBatch<Buy>(buySlots));
+        for(int slot:slots)
+        {
+            orderMap.erase(arena.getOrderID(slot));
+            stats.mapLookups++;
+            ReleaseSlot(slot);
+        }
+        stats.massCanceled+=slots.size();
+        cout<<"MASSCANCEL "<<owner<<" "<<slots.size()<<endl;
+    }
+    void PrintDepth(const string &side,const vector<pair<int,long long>> &depth)
+    {
+        for(auto &level:depth)
+        {
+            cout<<"DEPTH "<<side<<" "<<level.first<<" "<<level.second<<endl;
+        }
+    }
+    void SetAllocationPolicy(const string &name,int percent)
+    {
+        if(name=="FIFO")
+        {
+            policy=AllocationPolicy::FIFO;
+        }
+        else if(name=="PRORATA")
+        {
+            policy=AllocationPolicy::PRORATA;
+        }
+        else if(name=="TOPPRORATA")
+        {
+            policy=AllocationPolicy::TOPPRORATA;
+        }
+        else if(name=="SPLIT" && percent>=-1 && percent<=100)
+        {
+            policy=AllocationPolicy::SPLIT;
+            if(percent>=0)
+            {
+                splitPercent=percent;
+            }
+        }
+    }
+    void AllocateLevel(const Level &level,long long amount)
+    {
+        allocSlots.clear();
+        allocQuantity.clear();
+        for(int slot=level.head;slot>=0;slot=arena.getNext(slot))
+        {
+            allocSlots.push_back(slot);
+            allocQuantity.push_back(arena.getQuantity(slot));
+        }
+        int n=(int)allocSlots.size();
+        allocFill.assign(n,0);
+        long long inTime=0;
+        if(policy==AllocationPolicy::TOPPRORATA)
+        {
+            inTime=min(amount,(long long)allocQuantity[0]);
+        }
+        else if(policy==AllocationPolicy::SPLIT)
+        {
+            inTime=amount*splitPercent/100;
+        }
+        amount-=inTime;
+        for(int i=0;i<n && inTime>0;i++)
+        {
+            allocFill[i]=(int)min(inTime,(long long)allocQuantity[i]);
+            inTime-=allocFill[i];
+        }
+        allocateProRata(allocQuantity.data(),allocFill.data(),n,amount+inTime);
+    }
+    template<class Side>
+    void FillResting(int slot,int fillQty)
+    {
+        int qty=arena.getQuantity(slot);
+        if(fillQty==qty)
+        {
+            stats.fullFills++;
+            OrderFilled<Side>(slot);
+        }
+        else
+        {
+            stats.partialFills++;
+            UpdateOrder<Side>(slot,qty-fillQty);
+        }
+    }
+    template<class Resting>
+    void MatchLevel(int aggressorSlot)
+    {
+        using Aggressor=typename Resting::Opposite;
+        Level &level=QH.bestLevel<Resting>();
+        int price=level.price;
+        int aggressorQty=arena.getQuantity(aggressorSlot);
+        AllocateLevel(level,aggressorQty);
+        int traded=0;
+        for(size_t i=0;i<allocSlots.size();i++)
+        {
+            int slot=allocSlots[i];
+            int fillQty=allocFill[i];
+            if(fillQty==0)
+            {
+                continue;
+            }
+            if constexpr(Resting::type==SideType::BUY)
+            {
+                PrintMatch(slot,aggressorSlot,fillQty);
+            }
+            else
+            {
+                PrintMatch(aggressorSlot,slot,fillQty);
+            }
+            RecordTrade(price,fillQty);
+            traded+=fillQty;
+            FillResting<Resting>(slot,fillQty);
+        }
+        FillResting<Aggressor>(aggressorSlot,traded);
+    }
+    template<class Side>
+    void OrderFilled(int slot)
+    {
+        if(arena.getHiddenQuantity(slot)>0)
+        {
+            Replenish<Side>(slot);
+        }
+        else
+        {
+            CancelOrder<Side>(slot);
+        }
+    }
+    template<class Side>
+    void Replenish(int slot)
+    {
+        stats.icebergRefills++;
+        int displayed=arena.takeHidden(slot);
+        QH.requeue<Side>(slot,displayed);
+    }
+    void AdvanceTime(long long now)
+    {
+        vector<int> expired;
+        timers.advance(now,expired);
+        analytics.onTime(timers.getNow());
+        sort(expired.begin(),expired.end(),[this](int slot1,int slot2){return make_pair(arena.getExpiryTime(slot1),arena.getTurn(slot1))<make_pair(arena.getExpiryTime(slot2),arena.getTurn(slot2));});
+        for(int slot:expired)
+        {
+            stats.ordersExpired++;
+            cout<<"EXPIRED "<<arena.getOrderID(slot)<<" "<<arena.getQuantity(slot)+arena.getHiddenQuantity(slot)<<endl;
+            if(arena.getSide(slot)==SideType::BUY)
+            {
+                CancelOrder<Buy>(slot);
+            }
+            else
+            {
+                CancelOrder<Sell>(slot);
+            }
+        }
+    }
+    void Match()
+    {
+        bool keepMatching=true;
+        stats.matchCalls++;
+        tracer.record(TraceType::MATCH_BEGIN);
+        while(keepMatching)
+        {
+            stats.matchIterations++;
+            if((!QH.empty<Buy>()&&!QH.empty<Sell>())&&Buy::crosses(QH.bestLevel<Buy>().price,QH.bestLevel<Sell>().price))
+            {
+                int buySlot=QH.top<Buy>();
+                int sellSlot=QH.top<Sell>();
+                if(policy!=AllocationPolicy::FIFO)
+                {
+                    if(arena.getTurn(buySlot)>arena.getTurn(sellSlot))
+                    {
+                        MatchLevel<Sell>(buySlot);
+                    }
+                    else
+                    {
+                        MatchLevel<Buy>(sellSlot);
+                    }
+                    continue;
+                }
+                int buyQty=arena.getQuantity(buySlot);
+                int sellQty=arena.getQuantity(sellSlot);
+                int minQty=min(buyQty,sellQty);
+                PrintMatch(buySlot,sellSlot,minQty);
+                RecordTrade(arena.getTurn(buySlot)<arena.getTurn(sellSlot)?arena.getPriceBid(buySlot):arena.getPriceBid(sellSlot),minQty);
+                if(buyQty!=sellQty)
+                {
+                    stats.partialFills++;
+                    stats.fullFills++;
+                    int nwqty=0;
+                    if(buyQty>sellQty)
+                    {
+                        nwqty=buyQty-sellQty;
+                        UpdateOrder<Buy>(buySlot,nwqty);
+                        OrderFilled<Sell>(sellSlot);
+                    }
+                    else
+                    {
+                        nwqty=sellQty-buyQty;
+                        UpdateOrder<Sell>(sellSlot,nwqty);
+                        OrderFilled<Buy>(buySlot);
+                    }
+                }
+                else
+                {
+                    stats.fullFills+=2;
+                    OrderFilled<Buy>(buySlot);
+                    OrderFilled<Sell>(sellSlot);
+                }
+            }
+            else
+            {
+                keepMatching=false;
+            }
+        }
+        tracer.record(TraceType::MATCH_END);
+        TriggerStops();
+    }
+    void RecordTrade(int price,int qty)
+    {
+        lastTradePrice=price;
+        analytics.onTrade(price,qty,timers.getNow());
+        tracer.record(TraceType::FILL,qty);
+    }
+    void SetBars(const string &mode,long long size)
+    {
+        analytics.setBars(mode,size);
+    }
+    void PrintAnalytics()
+    {
+        analytics.print();
+    }
+    void PrintMatch(int buySlot,int sellSlot,int minQty)
+    {
+        if(arena.getTurn(buySlot)<arena.getTurn(sellSlot))
+        {
+            cout<<"TRADE " + arena.getOrderID(buySlot) + " "<<arena.getPriceBid(buySlot)<<" "<<minQty<<" " + arena.getOrderID(sellSlot) + " "<<arena.getPriceBid(sellSlot)<<" "<<minQty<<endl;
+        }
+        else
+        {
+            cout<<"TRADE " + arena.getOrderID(sellSlot) + " "<<arena.getPriceBid(sellSlot)<<" "<< minQty<<" " + arena.getOrderID(buySlot) + " "<<arena.getPriceBid(buySlot)<<" "<< minQty<<endl;
+        }
+    }
+    void SetLazyDelete(bool lazy)
+    {
+        QH.setLazyDelete(lazy);
+    }
+    bool SetIndexMode(const string &name)
+    {
+        if(name=="auto")
+        {
+            QH.setIndexMode(IndexMode::AUTO);
+        }
+        else if(name=="native")
+        {
+            QH.setIndexMode(IndexMode::NATIVE);
+        }
+        else if(name=="ladder")
+        {
+            QH.setIndexMode(IndexMode::LADDER);
+        }
+        else if(name=="bitmap")
+        {
+            QH.setIndexMode(IndexMode::BITMAP);
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+    void Adapt()
+    {
+        if(++sinceAdapt<adaptInterval)
+        {
+            return;
+        }
+        sinceAdapt=0;
+        QH.adapt<Buy>();
+        QH.adapt<Sell>();
+    }
+    void CountMarketFill(int remaining)
+    {
+        if(remaining==0)
+        {
+            stats.fullFills++;
+        }
+        else
+        {
+            stats.partialFills++;
+        }
+    }
+    void PrintFill(int slot,const string &orderID,int price,int qty)
+    {
+        cout<<"TRADE " + arena.getOrderID(slot) + " "<<price<<" "<<qty<<" " + orderID + " "<<price<<" "<<qty<<endl;
+    }
+    void PrintStats()
+    {
+        stats.PrintStats();
+    }
+    void PrintMemory()
+    {
+        cout<<"MEMORY: "<<endl;
+        memoryUsage.print();
+        long long orders=arena.slots()-arena.freeCount();
+        cout<<"ORDERS "<<orders<<endl;
+        cout<<"BYTES_PER_ORDER "<<(orders>0?memoryUsage.variable()/orders:0)<<endl;
+        cout<<"FREE_SLOTS "<<arena.freeCount()<<" "<<arena.slots()<<endl;
+#if defined(__GLIBC__) && (__GLIBC__>2 || (__GLIBC__==2 && __GLIBC_MINOR__>=33))
+        struct mallinfo2 heap=mallinfo2();
+        cout<<"HEAP "<<heap.uordblks+heap.hblkhd<<" "<<heap.fordblks<<endl;
+#endif
+        cout<<"BUDGET "<<memoryBudget<<" "<<memoryRejected<<endl;
+    }
+    void SetMemoryBudget(long long budget)
+    {
+        memoryBudget=budget;
+    }
+    void PrintBBO()
+    {
+        const Level *bid=QH.cachedBest<Buy>();
+        const Level *ask=QH.cachedBest<Sell>();
+        cout<<"BBO "<<(bid?bid->price:0)<<" "<<(bid?bid->quantity:0)<<" "<<(ask?ask->price:0)<<" "<<(ask?ask->quantity:0)<<endl;
+    }
+    void PrintSpread()
+    {
+        const Level *bid=QH.cachedBest<Buy>();
+        const Level *ask=QH.cachedBest<Sell>();
+        if(bid && ask)
+        {
+            cout<<"SPREAD "<<ask->price-bid->price<<endl;
+        }
+        else
+        {
+            cout<<"SPREAD NA"<<endl;
+        }
+    }
+    void PrintStatus(const string &orderID)
+    {
+        int slot=orderMap.find(orderID);
+        stats.mapLookups++;
+        if(slot<0)
+        {
+            cout<<"STATUS "<<orderID<<" NONE"<<endl;
+            return;
+        }
+        bool stop=arena.isStop(slot);
+        cout<<"STATUS "<<orderID<<(stop?" STOP ":" LIVE ")<<(arena.getSide(slot)==SideType::BUY?"BUY ":"SELL ")<<(stop?arena.getTriggerPrice(slot):arena.getPriceBid(slot))<<" "<<arena.getQuantity(slot)+arena.getHiddenQuantity(slot)<<endl;
+    }
+    void PrintHash(long long sequence=-1)
+    {
+        ostringstream hash;
+        hash<<hex<<setw(16)<<setfill('0')<<QH.getBookHash();
+        cout<<"HASH ";
+        if(sequence>=0)
+        {
+            cout<<sequence<<" ";
+        }
+        cout<<hash.str()<<endl;
+    }
+    void Snapshot(const string &path)
+    {
+        ReapSnapshots(false);
+        cout.flush();
+        pid_t pid=fork();
+        if(pid>0)
+        {
+            snapshots++;
+            return;
+        }
+        ofstream file(path);
+        streambuf *output=cout.rdbuf(file.rdbuf());
+        PrintOrderBook();
+        PrintHash();
+        cout.rdbuf(output);
+        file.close();
+        if(pid==0)
+        {
+            _exit(file?0:1);
+        }
+    }
+    void ReapSnapshots(bool wait)
+    {
+        int status;
+        while(snapshots>0 && waitpid(-1,&status,wait?0:WNOHANG)>0)
+        {
+            snapshots--;
+            if(!WIFEXITED(status) || WEXITSTATUS(status)!=0)
+            {
+                cerr<<"snapshot failed"<<endl;
+            }
+        }
+    }
+    bool OpenSharedBook(const string &name)
+    {
+        return publisher.open(name);
+    }
+    void Publish()
+    {
+        if(!publisher.isOpen())
+        {
+            return;
+        }
+        vector<pair<int,long long>> depth[2]={TopLevels<Buy>(BookState::depth),TopLevels<Sell>(BookState::depth)};
+        publisher.publish(depth);
+    }
+    void Prefetch(const string &orderID,const string &orderType,int priceBid)
+    {
+        if(orderID!="")
+        {
+            orderMap.prefetch(orderID);
+        }
+        if(orderType=="BUY")
+        {
+            PrefetchLevel<Buy>(priceBid);
+        }
+        else if(orderType=="SELL")
+        {
+            PrefetchLevel<Sell>(priceBid);
+        }
+    }
+    template<class Side>
+    void PrefetchLevel(int priceBid)
+    {
+        auto &sideLevels=QH.levelMap<Side>();
+        size_t bucket=sideLevels.bucket(priceBid);
+        auto bitr=sideLevels.begin(bucket);
+        if(bitr!=sideLevels.end(bucket))
+        {
+            __builtin_prefetch(&*bitr);
+        }
+    }
+    void PrintTopDepth(int n)
+    {
+        PrintDepth("SELL",TopLevels<Sell>(n));
+        PrintDepth("BUY",TopLevels<Buy>(n));
+    }
+    template<class Side>
+    vector<pair<int,long long>> TopLevels(int n)
+    {
+        vector<pair<int,long long>> depth;
+        PriceLadder &ladder=QH.ladder<Side>();
+        if(ladder.isDense())
+        {
+            int price=Side::type==SideType::BUY?ladder.highest():ladder.lowest();
+            while(price!=0 && (int)depth.size()<n)
+            {
+                depth.push_back({price,QH.levelMap<Side>().find(price)->second.quantity});
+                price=Side::type==SideType::BUY?ladder.below(price):ladder.above(price);
+            }
+            return depth;
+        }
+        if(QH.isDirect<Side>())
+        {
+            const LevelBitmap &bitmap=QH.bitmap<Side>();
+            int price=Side::type==SideType::BUY?bitmap.highest():bitmap.lowest();
+            while(price!=0 && (int)depth.size()<n)
+            {
+                depth.push_back({price,QH.levelMap<Side>().find(price)->second.quantity});
+                price=Side::type==SideType::BUY?bitmap.below(price):bitmap.above(price);
+            }
+            return depth;
+        }
+        for(auto &currLevel:QH.levelMap<Side>())
+        {
+            if(currLevel.second.count>0)
+            {
+                depth.push_back({currLevel.first,currLevel.second.quantity});
+            }
+        }
+        size_t levels=min(depth.size(),(size_t)max(n,0));
+        partial_sort(depth.begin(),depth.begin()+levels,depth.end(),[](const pair<int,long long> &level1,const pair<int,long long> &level2){return Side::better(level1.first,level2.first);});
+        depth.resize(levels);
+        return depth;
+    }
+    void PrintOrderBook()
+    {
+        cout<<"SELL: "<<endl;
+        PrintQueue<Sell>();
+        cout<<"BUY: "<<endl;
+        PrintQueue<Buy>();
+    }
+    template<class Side>
+    void PrintQueue()
+    {
+        PriceLadder &ladder=QH.ladder<Side>();
+        if(ladder.isDense())
+        {
+            for(int price=ladder.highest();price!=0;price=ladder.below(price))
+            {
+                cout<<price<<" "<<QH.levelMap<Side>().find(price)->second.quantity<<endl;
+            }
+            return;
+        }
+        if(QH.isDirect<Side>())
+        {
+            const LevelBitmap &bitmap=QH.bitmap<Side>();
+            for(int price=bitmap.highest();price!=0;price=bitmap.below(price))
+            {
+                cout<<price<<" "<<QH.levelMap<Side>().find(price)->second.quantity<<endl;
+            }
+            return;
+        }
+        map<int,long long,greater<int>,CountingAllocator<pair<const int,long long>,MemoryAccount::PRINT>> temp;
+        for(auto &currLevel:QH.levelMap<Side>())
+        {
+            if(currLevel.second.count>0)
+            {
+                temp[currLevel.first]=currLevel.second.quantity;
+            }
+        }
+        for(auto itr=temp.begin();itr!=temp.end();itr++)
+        {
+            cout<<itr->first<<" "<<itr->second<<endl;
+        }
+    }
+};
+
+struct EngineOptions
+{
+    int lazy=-1;
+    string indexMode="auto";
+    long long memoryBudget=0;
+    long long hashEvery=0;
+};
+
+class InputMachine
+{
+private:
+    OrderBook OB;
+    static const int prefetchDistance=4;
+    long long sequence=0;
+    long long hashEvery=0;
+    static bool ParseExtra(const vector<string> &inputLine,long long &extra)
+    {
+        extra=0;
+        const string &executionType=inputLine[1];
+        if(executionType!="ICEBERG" && executionType!="STOPLIMIT" && executionType!="GTT")
+        {
+            return true;
+        }
+        for(size_t i=5;i<inputLine.size();i++)
+        {
+            if(inputLine[i]!="")
+            {
+                char *end;
+                errno=0;
+                extra=strtoll(inputLine[i].c_str(),&end,10);
+                return *end=='\0' && errno==0 && (executionType=="GTT" || extra<=INT_MAX);
+            }
+        }
+        return false;
+    }
+    bool InsertOrder(vector<string> &inputLine)
+    {
+        string owner;
+        while(inputLine.size()>5 && inputLine.back()=="")
+        {
+            inputLine.pop_back();
+        }
+        if(inputLine.size()>5 && inputLine.back()[0]=='@')
+        {
+            owner=inputLine.back().substr(1);
+            inputLine.pop_back();
+        }
+        long long extra;
+        if(!ParseExtra(inputLine,extra))
+        {
+            return false;
+        }
+        return OB.InsertOrder(inputLine[0],inputLine[1],stoi(inputLine[2]),stoi(inputLine[3]),inputLine[4],extra,owner);
+    }
+public:
+    bool configure(const EngineOptions &options)
+    {
+        if(options.lazy>=0)
+        {
+            OB.SetLazyDelete(options.lazy==1);
+        }
+        OB.SetMemoryBudget(options.memoryBudget);
+        hashEvery=options.hashEvery;
+        return OB.SetIndexMode(options.indexMode);
+    }
+    OrderBook& getOrderBook()
+    {
+        return OB;
+    }
+    void HandleBatch(vector<vector<string>> &batch,vector<bool> *accepted=nullptr)
+    {
+        if(accepted)
+        {
+            accepted->assign(batch.size(),false);
+        }
+        for(size_t i=0;i<batch.size();i++)
+        {
+            if(i+prefetchDistance<batch.size())
+            {
+                Prefetch(batch[i+prefetchDistance]);
+            }
+            bool changed=HandleInput(batch[i]);
+            if(accepted)
+            {
+                (*accepted)[i]=changed;
+            }
+        }
+        tracer.record(TraceType::BATCH_END,batch.size());
+    }
+    void Prefetch(const vector<string> &inputLine)
+    {
+        const string &command=inputLine[0];
+        if((command=="BUY"||command=="SELL") && inputLine.size()>4 && isdigit((unsigned char)inputLine[2][0]))
+        {
+            OB.Prefetch(inputLine[4],command,stoi(inputLine[2]));
+        }
+        else if(command=="MODIFY" && inputLine.size()>4 && isdigit((unsigned char)inputLine[3][0]))
+        {
+            OB.Prefetch(inputLine[1],inputLine[2],stoi(inputLine[3]));
+        }
+        else if(command=="CANCEL" && inputLine.size()>1)
+        {
+            OB.Prefetch(inputLine[1],"",0);
+        }
+    }
+    bool HandleInput(vector<string> &inputLine)
+    {
+        tracer.record(TraceType::MESSAGE_BEGIN,sequence+1);
+        bool changed=false;
+        char operationToExecute=inputLine[0][0];
+        switch(operationToExecute)
+        {
+            case 'B':
+                if(inputLine[0]=="BARS")
+                {
+                    OB.SetBars(inputLine[1],stoll(inputLine[2]));
+                    changed=true;
+                }
+                else if(inputLine[0]=="BBO")
+                {
+                    OB.PrintBBO();
+                }
+                else
+                {
+                    changed=InsertOrder(inputLine);
+                }
+                break;
+            case 'S':
+                if(inputLine[0]=="STATS")
+                {
+                    OB.PrintStats();
+                }
+                else if(inputLine[0]=="SPREAD")
+                {
+                    OB.PrintSpread();
+                }
+                else if(inputLine[0]=="STATUS")
+                {
+                    OB.PrintStatus(inputLine[1]);
+                }
+                else if(inputLine[0]=="SNAPSHOT")
+                {
+                    OB.Snapshot(inputLine[1]);
+                }
+                else
+                {
+                    changed=InsertOrder(inputLine);
+                }
+                break;
+            case 'M':
+                if(inputLine[0]=="MASSCANCEL")
+                {
+                    OB.MassCancel(inputLine[1]);
+                    changed=true;
+                }
+                else if(inputLine[0]=="MEMORY")
+                {
+                    OB.PrintMemory();
+                }
+                else
+                {
+                    changed=OB.ModifyOrder(inputLine[1], inputLine[2],stoi(inputLine[3]),stoi(inputLine[4]));
+                }
+                break;
+            case 'C':
+                changed=OB.CancelOrder(inputLine[1]);
+                break;
+            case 'P':
+                if(inputLine[0]=="POLICY")
+                {
+                    OB.SetAllocationPolicy(inputLine[1],inputLine.size()>2 && inputLine[2]!=""?stoi(inputLine[2]):-1);
+                    changed=true;
+                }
+                else
+                {
+                    OB.PrintOrderBook();
+                }
+                break;
+            case 'D':
+                OB.PrintTopDepth(stoi(inputLine[1]));
+                break;
+            case 'A':
+                OB.PrintAnalytics();
+                break;
+            case 'T':
+                if(inputLine[0]=="TRACE")
+                {
+                    if(tracer.isEnabled() && !tracer.dump(inputLine.size()>1?inputLine[1]:""))
+                    {
+                        cerr<<"can not dump the trace"<<endl;
+                    }
+                }
+                else
+                {
+                    OB.AdvanceTime(stoll(inputLine[1]));
+                    changed=true;
+                }
+                break;
+            case 'H':
+                OB.PrintHash();
+                break;
+        }
+        OB.Publish();
+        OB.Adapt();
+        sequence++;
+        if(hashEvery>0 && sequence%hashEvery==0)
+        {
+            OB.PrintHash(sequence);
+        }
+        tracer.record(TraceType::MESSAGE_END,sequence);
+        return changed;
     }
 };
-
-bool operator<(const Order& order1, const Order& order2)
-{
-    if(order1.getPriceBid()==order2.getPriceBid())
-    {
-        return order1.getTurn()>order2.getTurn();
-    }
-    return order1.getPriceBid() < order2.getPriceBid();
-}
-bool operator>(const Order& order1, const Order& order2)
+struct NullBuffer:streambuf
 {
-    if(order1.getPriceBid()==order2.getPriceBid())
+    int overflow(int c) override
     {
-        return order1.getTurn()>order2.getTurn();
+        return c;
     }
-    return order1.getPriceBid() > order2.getPriceBid();
-}
+};
 
-class QueueHandler
+class ReplayDriver
 {
 private:
-    priority_queue<Order> buyPriority;
-    priority_queue<Order,vector<Order>,greater<Order>> sellPriority;
-public:
-    void addToBuyQueue(Order &currOrder)
+    struct Message
     {
-        buyPriority.push(currOrder);
-    }
-    void addToSellQueue(Order &currOrder)
+        size_t index;
+        long long sendTime;
+    };
+    static const size_t ringSize=1<<16;
+    vector<vector<string>> commands;
+    vector<long long> timestamps;
+    vector<Message> ring=vector<Message>(ringSize);
+    atomic<size_t> head{0};
+    atomic<size_t> tail{0};
+    static long long nowNanos()
     {
-        sellPriority.push(currOrder);
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
     }
-    
-    void deleteFromQueue(Order &currOrder,string orderID)
+    static void waitUntil(long long time)
     {
-        string orderType=currOrder.getOrderType();
-        if(orderType=="BUY")
+        long long remaining=time-nowNanos();
+        if(remaining>100000)
         {
-            Delete(buyPriority,orderID);
+            this_thread::sleep_for(chrono::nanoseconds(remaining-50000));
         }
-        else if(orderType=="SELL")
+        while(nowNanos()<time)
         {
-            Delete(sellPriority,orderID);
+            this_thread::yield();
         }
     }
-
-    void Delete(priority_queue<Order> &currQueue,string orderID)
+    long long offset(size_t i,double rate,double speed) const
     {
-        vector<Order> temp;
-        while(!currQueue.empty())
+        if(rate>0)
+        {
+            return (long long)(i*1e9/rate);
+        }
+        return (long long)((timestamps[i]-timestamps[0])*1000/speed);
+    }
+public:
+    bool load(const string &file)
+    {
+        ifstream in(file);
+        if(!in)
         {
-            if(orderID!=currQueue.top().getOrderID())
+            return false;
+        }
+        string input;
+        bool timed=true;
+        while(getline(in,input))
+        {
+            vector<string> inputLine;
+            stringstream ss(input);
+            while(ss.good())
             {
-                temp.push_back(currQueue.top());
-                currQueue.pop();
+                string inputWord;
+                getline(ss,inputWord,' ');
+                inputLine.push_back(inputWord);
+            }
+            if(inputLine[0].empty())
+            {
+                continue;
+            }
+            if(timed && isdigit((unsigned char)inputLine[0][0]) && inputLine.size()>1)
+            {
+                timestamps.push_back(stoll(inputLine[0]));
+                inputLine.erase(inputLine.begin());
             }
             else
             {
-                currQueue.pop();
-                break;
+                timed=false;
             }
+            commands.push_back(move(inputLine));
         }
-        for(Order currOrder:temp)
+        if(!timed || timestamps.size()!=commands.size())
         {
-            currQueue.push(currOrder);
+            timestamps.clear();
         }
+        return true;
     }
-    void Delete(priority_queue<Order,vector<Order>,greater<Order>> &currQueue,string orderID)
+    bool isTimed() const
     {
-        vector<Order> temp;
-        while(!currQueue.empty())
+        return !timestamps.empty();
+    }
+    void run(double rate,double speed,const EngineOptions &options)
+    {
+        if(commands.empty())
+        {
+            return;
+        }
+        InputMachine machine;
+        machine.configure(options);
+        vector<long long> latencies(commands.size());
+        head.store(0);
+        tail.store(0);
+        NullBuffer nullBuffer;
+        streambuf *output=cout.rdbuf(&nullBuffer);
+        long long start=nowNanos()+1000000;
+        thread producer([&]()
         {
-            if(orderID!=currQueue.top().getOrderID())
+            for(size_t i=0;i<commands.size();i++)
             {
-                temp.push_back(currQueue.top());
-                currQueue.pop();
+                long long sendTime=start+offset(i,rate,speed);
+                waitUntil(sendTime);
+                size_t h=head.load(memory_order_relaxed);
+                while(h-tail.load(memory_order_acquire)>=ringSize)
+                {
+                    this_thread::yield();
+                }
+                ring[h%ringSize]={i,sendTime};
+                head.store(h+1,memory_order_release);
             }
-            else
+        });
+        for(size_t processed=0;processed<commands.size();)
+        {
+            size_t t=tail.load(memory_order_relaxed);
+            if(t==head.load(memory_order_acquire))
             {
-                currQueue.pop();
-                break;
+                this_thread::yield();
+                continue;
             }
+            Message message=ring[t%ringSize];
+            vector<string> inputLine=commands[message.index];
+            machine.HandleInput(inputLine);
+            latencies[processed++]=nowNanos()-message.sendTime;
+            tail.store(t+1,memory_order_release);
         }
-        for(Order currOrder:temp)
-        {
-            currQueue.push(currOrder);
-        }
+        producer.join();
+        cout.rdbuf(output);
+        sort(latencies.begin(),latencies.end());
+        auto percentile=[&](double p){return latencies[min(latencies.size()-1,(size_t)(p*latencies.size()))];};
+        cout<<"REPLAY "<<(rate>0?to_string((long long)rate):"RECORDED")<<" "<<latencies.size()<<" "<<percentile(0.5)<<" "<<percentile(0.9)<<" "<<percentile(0.99)<<" "<<percentile(0.999)<<" "<<latencies.back()<<endl;
     }
-    friend class OrderBook;
 };
 
-class OrderBook
+class LogShipper
 {
 private:
-    unordered_map<string, Order> orderMap;
-    int turn=0;
-    QueueHandler QH;
-    
-public:
-    void InsertOrder(string orderType,string executionType,int priceBid,int quantity,string orderID)
+    static const long long window=4096;
+    int fd=-1;
+    mutex lock;
+    condition_variable ready;
+    vector<string> pending;
+    long long sent=0;
+    long long acked=0;
+    bool closing=false;
+    bool broken=false;
+    thread sender;
+    thread acker;
+    void sendLoop()
     {
-        if(orderID!="" && priceBid>0 && quantity>0 && (orderType=="BUY"||orderType=="SELL") && (executionType=="IOC"||executionType=="GFD"))
+        vector<string> batch;
+        string buffer;
+        while(true)
         {
-            orderMap[orderID].createOrder(orderID,orderType,executionType,priceBid,quantity,++turn);
-            if(executionType=="GFD")
+            long long sequence;
+            {
+                unique_lock<mutex> guard(lock);
+                ready.wait(guard,[this]{return broken || ((!pending.empty() || closing) && sent-acked<window);});
+                if(broken || (pending.empty() && closing))
+                {
+                    return;
+                }
+                size_t count=min(pending.size(),(size_t)(window-(sent-acked)));
+                batch.assign(make_move_iterator(pending.begin()),make_move_iterator(pending.begin()+count));
+                pending.erase(pending.begin(),pending.begin()+count);
+                sequence=sent;
+                sent+=count;
+            }
+            buffer.clear();
+            for(string &command:batch)
             {
-                InsertOrderGFD(orderID);
+                buffer+=to_string(++sequence)+" "+command+"\n";
             }
-            else if(executionType=="IOC")
+            if(!writeAll(fd,buffer))
             {
-                InsertOrderIOC(orderID);
+                lock_guard<mutex> guard(lock);
+                shutdownSocket();
+                ready.notify_all();
+                return;
             }
+            tracer.record(TraceType::LOG_SHIPPED,sequence);
         }
     }
-    
-    void InsertOrderGFD(string orderID)
+    void ackLoop()
     {
-        string orderType=orderMap[orderID].getOrderType();
-        if(orderType=="BUY")
+        string buffer;
+        char chunk[4096];
+        while(true)
         {
-            QH.addToBuyQueue(orderMap[orderID]);
-        }
-        else if(orderType=="SELL")
-        {
-            QH.addToSellQueue(orderMap[orderID]);
+            ssize_t n=read(fd,chunk,sizeof(chunk));
+            if(n<=0)
+            {
+                lock_guard<mutex> guard(lock);
+                shutdownSocket();
+                ready.notify_all();
+                return;
+            }
+            buffer.append(chunk,n);
+            size_t end;
+            while((end=buffer.find('\n'))!=string::npos)
+            {
+                long long sequence=stoll(buffer.substr(4,end-4));
+                buffer.erase(0,end+1);
+                lock_guard<mutex> guard(lock);
+                acked=max(acked,sequence);
+                tracer.record(TraceType::LOG_ACKED,sequence);
+            }
+            ready.notify_all();
         }
-        Match();
     }
-    
-    void InsertOrderIOC(string orderID)
+    void shutdownSocket()
     {
-        string orderType=orderMap[orderID].getOrderType();
-        if(orderType=="BUY")
+        broken=true;
+        pending.clear();
+        shutdown(fd,SHUT_RDWR);
+    }
+public:
+    ~LogShipper()
+    {
+        stop();
+    }
+    static bool writeAll(int sock,const string &buffer)
+    {
+        size_t done=0;
+        while(done<buffer.size())
         {
-            QH.addToBuyQueue(orderMap[orderID]);
-            if(orderID==QH.buyPriority.top().getOrderID())
+            ssize_t n=send(sock,buffer.data()+done,buffer.size()-done,MSG_NOSIGNAL);
+            if(n<0 && errno==EINTR)
+            {
+                continue;
+            }
+            if(n<=0)
             {
-                Match();
+                return false;
             }
+            done+=n;
         }
-        else if(orderType=="SELL")
+        return true;
+    }
+    bool start(const string &path)
+    {
+        sockaddr_un address{};
+        address.sun_family=AF_UNIX;
+        strncpy(address.sun_path,path.c_str(),sizeof(address.sun_path)-1);
+        fd=socket(AF_UNIX,SOCK_STREAM,0);
+        if(fd<0 || connect(fd,(sockaddr*)&address,sizeof(address))!=0)
         {
-            QH.addToSellQueue(orderMap[orderID]);
-            if(orderID==QH.sellPriority.top().getOrderID())
+            if(fd>=0)
             {
-                Match();
+                close(fd);
             }
+            fd=-1;
+            return false;
         }
-        QH.deleteFromQueue(orderMap[orderID],orderID);
-        orderMap.erase(orderID);
+        sender=thread(&LogShipper::sendLoop,this);
+        acker=thread(&LogShipper::ackLoop,this);
+        return true;
     }
-    
-    void ModifyOrder(string orderID,string orderType,int priceBid,int quantity)
+    bool isActive() const
     {
-        auto fitr=orderMap.find(orderID);
-        if(fitr!=orderMap.end())
+        return fd>=0;
+    }
+    void append(vector<string> &commands,const vector<bool> &accepted)
+    {
+        if(commands.empty())
+        {
+            return;
+        }
         {
-            if(priceBid>0 && quantity>0 && (orderType=="BUY"||orderType=="SELL"))
+            lock_guard<mutex> guard(lock);
+            if(broken)
             {
-                QH.deleteFromQueue(fitr->second,orderID);
-                orderMap[orderID].modifyOrder(orderType,priceBid,quantity,++turn);
-                if(orderType=="BUY")
-                {
-                    QH.addToBuyQueue(orderMap[orderID]);
-                }
-                else if(orderType=="SELL")
+                return;
+            }
+            for(size_t i=0;i<commands.size();i++)
+            {
+                if(accepted[i])
                 {
-                    QH.addToSellQueue(orderMap[orderID]);
+                    pending.push_back(move(commands[i]));
                 }
-                Match();
             }
         }
+        ready.notify_one();
     }
-    
-    void UpdateOrder(string orderID,int newQuantity)
-     {
-        orderMap[orderID].setQuantity(newQuantity);
-        string orderType=orderMap[orderID].getOrderType();
-        QH.deleteFromQueue(orderMap[orderID],orderID);
-        if(orderType=="BUY")
+    void stop()
+    {
+        if(fd<0)
         {
-            QH.addToBuyQueue(orderMap[orderID]);
+            return;
         }
-        else if(orderType=="SELL")
         {
-            QH.addToSellQueue(orderMap[orderID]);
+            lock_guard<mutex> guard(lock);
+            closing=true;
         }
-     }
-    
-    void CancelOrder(string orderID)
-    {
-        auto fitr=orderMap.find(orderID);
-        if(fitr!=orderMap.end())
+        ready.notify_all();
+        sender.join();
         {
-            QH.deleteFromQueue(fitr->second,orderID);
-            orderMap.erase(fitr);
+            unique_lock<mutex> guard(lock);
+            ready.wait(guard,[this]{return broken || acked>=sent;});
+            shutdownSocket();
         }
+        acker.join();
+        close(fd);
+        fd=-1;
     }
-    void Match()
+};
+
+class LogReceiver
+{
+public:
+    static long long run(const string &path,InputMachine &machine)
     {
-        bool keepMatching=true;
-        while(keepMatching)
+        sockaddr_un address{};
+        address.sun_family=AF_UNIX;
+        strncpy(address.sun_path,path.c_str(),sizeof(address.sun_path)-1);
+        unlink(path.c_str());
+        int listener=socket(AF_UNIX,SOCK_STREAM,0);
+        if(listener<0 || ::bind(listener,(sockaddr*)&address,sizeof(address))!=0 || listen(listener,1)!=0)
+        {
+            return -1;
+        }
+        int fd=accept(listener,nullptr,nullptr);
+        close(listener);
+        unlink(path.c_str());
+        if(fd<0)
+        {
+            return -1;
+        }
+        NullBuffer nullBuffer;
+        streambuf *output=cout.rdbuf(&nullBuffer);
+        long long applied=0;
+        string buffer;
+        char chunk[65536];
+        ssize_t n;
+        while((n=read(fd,chunk,sizeof(chunk)))>0)
         {
-            if((!QH.buyPriority.empty()&&!QH.sellPriority.empty())&&(QH.buyPriority.top().getPriceBid()>=QH.sellPriority.top().getPriceBid()))
+            buffer.append(chunk,n);
+            size_t start=0,end;
+            while((end=buffer.find('\n',start))!=string::npos)
             {
-                int buyQty=QH.buyPriority.top().getQuantity();
-                int sellQty=QH.sellPriority.top().getQuantity();
-                int minQty=min(buyQty,sellQty);
-                PrintMatch(minQty);
-                if(buyQty!=sellQty)
-                {
-                    int nwqty=0;
-                    if(buyQty>sellQty)
-                    {
-                        nwqty=buyQty-sellQty;
-                        UpdateOrder(QH.buyPriority.top().getOrderID(),nwqty);
-                        CancelOrder(QH.sellPriority.top().getOrderID());
-                    }
-                    else
-                    {
-                        nwqty=sellQty-buyQty;
-                        UpdateOrder(QH.sellPriority.top().getOrderID(),nwqty);
-                        CancelOrder(QH.buyPriority.top().getOrderID());
-                    }
-                }
-                else
+                size_t space=buffer.find(' ',start);
+                applied=stoll(buffer.substr(start,space-start));
+                vector<string> inputLine;
+                stringstream ss(buffer.substr(space+1,end-space-1));
+                while(ss.good())
                 {
-                    CancelOrder(QH.buyPriority.top().getOrderID());
-                    CancelOrder(QH.sellPriority.top().getOrderID());
+                    string inputWord;
+                    getline(ss,inputWord,' ');
+                    inputLine.push_back(inputWord);
                 }
+                machine.HandleInput(inputLine);
+                start=end+1;
             }
-            else
+            buffer.erase(0,start);
+            if(!LogShipper::writeAll(fd,"ACK "+to_string(applied)+"\n"))
             {
-                keepMatching=false;
+                break;
             }
         }
+        close(fd);
+        cout.rdbuf(output);
+        return applied;
     }
+};
+
+void requestTraceDump(int)
+{
+    tracer.requestDump();
+}
+
+int main(int argc, const char * argv[]) {
     
-    void PrintMatch(int minQty)
+    string input;
+    InputMachine IM;
+    int batchSize=1;
+    EngineOptions options;
+    string replayFile;
+    double rate=0;
+    double speed=1;
+    vector<double> sweep;
+    string standbyPath;
+    LogShipper shipper;
+    for(int i=1;i<argc;i++)
     {
-        int buyTurn= orderMap[QH.buyPriority.top().getOrderID()].getTurn();
-        int sellTurn= orderMap[QH.sellPriority.top().getOrderID()].getTurn();
-        if(buyTurn<sellTurn)
+        string option=argv[i];
+        if(option=="--lazy")
         {
-            cout<<"TRADE " + QH.buyPriority.top().getOrderID() + " "<<QH.buyPriority.top().getPriceBid()<<" "<<minQty<<" " + QH.sellPriority.top().getOrderID() + " "<<QH.sellPriority.top().getPriceBid()<<" "<<minQty<<endl;
+            options.lazy=1;
         }
-        else
+        else if(option=="--eager")
         {
-            cout<<"TRADE " + QH.sellPriority.top().getOrderID() + " "<<QH.sellPriority.top().getPriceBid()<<" "<< minQty<<" " + QH.buyPriority.top().getOrderID() + " "<<QH.buyPriority.top().getPriceBid()<<" "<< minQty<<endl;
+            options.lazy=0;
         }
-    }
-    void PrintOrderBook()
-    {
-        cout<<"SELL: "<<endl;
-        PrintSell(QH.sellPriority);
-        cout<<"BUY: "<<endl;
-        PrintBuy(QH.buyPriority);
-    }
-    void PrintSell(priority_queue<Order,vector<Order>,greater<Order>> currQueue)
-    {
-        map<int,int,greater<int>> temp;
-        while(!currQueue.empty())
+        else if(option.rfind("--replay=",0)==0)
         {
-            temp[currQueue.top().getPriceBid()]+=currQueue.top().getQuantity();
-            currQueue.pop();
+            replayFile=option.substr(9);
         }
-        for(auto itr=temp.begin();itr!=temp.end();itr++)
+        else if(option.rfind("--rate=",0)==0)
         {
-            cout<<itr->first<<" "<<itr->second<<endl;
+            rate=stod(option.substr(7));
+        }
+        else if(option.rfind("--speed=",0)==0)
+        {
+            speed=max(stod(option.substr(8)),1e-9);
+        }
+        else if(option.rfind("--primary=",0)==0)
+        {
+            if(!shipper.start(option.substr(10)))
+            {
+                cerr<<"can not connect to standby "<<option.substr(10)<<endl;
+                return 1;
+            }
+        }
+        else if(option.rfind("--standby=",0)==0)
+        {
+            standbyPath=option.substr(10);
+        }
+        else if(option.rfind("--sweep=",0)==0)
+        {
+            stringstream ss(option.substr(8));
+            string sweepRate;
+            while(getline(ss,sweepRate,','))
+            {
+                sweep.push_back(stod(sweepRate));
+            }
+        }
+        else if(option.rfind("--index=",0)==0)
+        {
+            options.indexMode=option.substr(8);
+        }
+        else if(option=="--trace" || option.rfind("--trace=",0)==0)
+        {
+            tracer.enable(option=="--trace"?"trace.json":option.substr(8));
+            signal(SIGUSR1,requestTraceDump);
+        }
+        else if(option.rfind("--mem-budget=",0)==0)
+        {
+            size_t digits;
+            long long budget=max(stoll(option.substr(13),&digits),0LL);
+            char unit=tolower(option.size()>13+digits?option[13+digits]:'b');
+            budget<<=unit=='k'?10:unit=='m'?20:unit=='g'?30:0;
+            options.memoryBudget=budget;
+        }
+        else if(option.rfind("--hash-every=",0)==0)
+        {
+            options.hashEvery=max(stoll(option.substr(13)),0LL);
+        }
+        else if(option.rfind("--batch=",0)==0)
+        {
+            batchSize=max(stoi(option.substr(8)),1);
+        }
+        else if(option.rfind("--shm=",0)==0)
+        {
+            if(!IM.getOrderBook().OpenSharedBook(option.substr(6)))
+            {
+                cerr<<"can not create shared memory "<<option.substr(6)<<endl;
+                return 1;
+            }
+        }
+        else if(option.rfind("--shm-read=",0)==0)
+        {
+            BookState state;
+            if(!BookPublisher::read(option.substr(11),state))
+            {
+                cerr<<"can not open shared memory "<<option.substr(11)<<endl;
+                return 1;
+            }
+            cout<<"SNAPSHOT "<<state.events<<endl;
+            for(int i=0;i<state.levels[1];i++)
+            {
+                cout<<"DEPTH SELL "<<state.prices[1][i]<<" "<<state.quantities[1][i]<<endl;
+            }
+            for(int i=0;i<state.levels[0];i++)
+            {
+                cout<<"DEPTH BUY "<<state.prices[0][i]<<" "<<state.quantities[0][i]<<endl;
+            }
+            return 0;
         }
     }
-    void PrintBuy(priority_queue<Order> currQueue)
+    if(!IM.configure(options))
     {
-        map<int,int,greater<int>> temp;
-        while(!currQueue.empty())
+        cerr<<"unknown index mode "<<options.indexMode<<endl;
+        return 1;
+    }
+    if(replayFile!="")
+    {
+        ReplayDriver driver;
+        if(!driver.load(replayFile))
         {
-            temp[currQueue.top().getPriceBid()]+=currQueue.top().getQuantity();
-            currQueue.pop();
+            cerr<<"can not read "<<replayFile<<endl;
+            return 1;
         }
-        for(auto itr=temp.begin();itr!=temp.end();itr++)
+        if(sweep.empty())
         {
-            cout<<itr->first<<" "<<itr->second<<endl;
+            sweep.push_back(rate);
         }
+        for(double sweepRate:sweep)
+        {
+            if(sweepRate<=0 && !driver.isTimed())
+            {
+                cerr<<"the capture has no timestamps, a rate is needed"<<endl;
+                return 1;
+            }
+            driver.run(sweepRate,speed,options);
+        }
+        return 0;
     }
-};
-
-class InputMachine
-{
-private:
-    OrderBook OB;
-public:
-    void HandleInput(vector<string> &inputLine)
+    if(standbyPath!="")
     {
-        char operationToExecute=inputLine[0][0];
-        switch(operationToExecute)
+        long long applied=LogReceiver::run(standbyPath,IM);
+        if(applied<0)
         {
-            case 'B':
-                OB.InsertOrder(inputLine[0],inputLine[1],stoi(inputLine[2]),stoi(inputLine[3]),inputLine[4]);
-                break;
-            case 'S':
-                OB.InsertOrder(inputLine[0],inputLine[1],stoi(inputLine[2]),stoi(inputLine[3]),inputLine[4]);
-                break;
-            case 'M':
-                OB.ModifyOrder(inputLine[1], inputLine[2],stoi(inputLine[3]),stoi(inputLine[4]));
-                break;
-            case 'C':
-                OB.CancelOrder(inputLine[1]);
-                break;
-            case 'P':
-                OB.PrintOrderBook();
-                break;
+            cerr<<"can not listen on "<<standbyPath<<endl;
+            return 1;
         }
+        cout<<"TAKEOVER "<<applied<<endl;
     }
-};
-int main(int argc, const char * argv[]) {
-    
-    string input;
-    InputMachine IM;
+    vector<vector<string>> batch;
+    vector<string> lines;
+    vector<bool> accepted;
     while(getline(cin, input)){
+        tracer.record(TraceType::MESSAGE_RECEIVED,input.size());
+        tracer.dumpIfRequested();
+        if(shipper.isActive())
+        {
+            lines.push_back(input);
+        }
         vector<string> inputLine;
         stringstream ss(input);
         while (ss.good())
@@ -382,7 +3835,19 @@ int main(int argc, const char * argv[]) {
             getline(ss, inputWord, ' ');
             inputLine.push_back(inputWord);
         }
-        IM.HandleInput(inputLine);
+        tracer.record(TraceType::PARSE_DONE,inputLine.size());
+        batch.push_back(move(inputLine));
+        if((int)batch.size()>=batchSize)
+        {
+            IM.HandleBatch(batch,shipper.isActive()?&accepted:nullptr);
+            shipper.append(lines,accepted);
+            batch.clear();
+            lines.clear();
+        }
     }
+    IM.HandleBatch(batch,shipper.isActive()?&accepted:nullptr);
+    shipper.append(lines,accepted);
+    IM.getOrderBook().ReapSnapshots(true);
+    shipper.stop();
     return 0;
 }
@@ -1,513 +1,5124 @@
 #include <iostream>
 #include <bits/stdc++.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
 
 using namespace std;
 
 /*
- Class to store the data (fields) and actions (methods) related to one order
- as well as getters and setters exposing only the necessary fields
- getters are implemented as constant functions to avoid unwanted modification of fields
+ Enum to represent the side of an order, it replaces the BUY and SELL strings once the input is parsed so the hot path compares integers instead of strings
+ */
+enum class SideType
+{
+    BUY,
+    SELL
+};
+
+/*
+ Enum to represent the policy used to allocate the quantity of an incoming order between the orders of a price level
+ FIFO: the orders are filled in time priority
+ PRORATA: the quantity is shared in proportion to the quantity of each order
+ TOPPRORATA: the first order in time priority is filled first, the rest is shared pro-rata
+ SPLIT: a percentage of the quantity is filled in time priority, the rest is shared pro-rata
+ */
+enum class AllocationPolicy
+{
+    FIFO,
+    PRORATA,
+    TOPPRORATA,
+    SPLIT
+};
+
+/*
+ Enum to represent how the price levels of each side are indexed to find the best one
+ AUTO: the index of each side is chosen at runtime from the shape of the book, the container for shallow sides, the PriceLadder for deep and dense ones and the LevelBitmap for deep and sparse ones
+ NATIVE: the levels are always kept in the container of the build, the set or the heap
+ LADDER: the levels are found with the PriceLadder, or with the LevelBitmap when the ladder is not dense
+ BITMAP: the levels are found with the LevelBitmap
+ */
+enum class IndexMode
+{
+    AUTO,
+    NATIVE,
+    LADDER,
+    BITMAP
+};
+
+/*
+ Structs to describe each side of the OrderBook at compile time, the side logic is written once as templates on these types and the compiler generates the code of each side without any runtime branching
+ type: SideType of the side
+ index: Position of the side in the arrays indexed by side
+ Opposite: struct of the other side of the OrderBook
+ better: constexpr function that returns true if price1 has priority over price2 in this side
+ crosses: constexpr function that returns true if an order of this side with price can trade against an order of the opposite side with oppositePrice
+ */
+struct Sell;
+struct Buy
+{
+    static constexpr SideType type=SideType::BUY;
+    static constexpr int index=0;
+    using Opposite=Sell;
+    static constexpr bool better(int price1,int price2)
+    {
+        return price1>price2;
+    }
+    static constexpr bool crosses(int price,int oppositePrice)
+    {
+        return price>=oppositePrice;
+    }
+};
+struct Sell
+{
+    static constexpr SideType type=SideType::SELL;
+    static constexpr int index=1;
+    using Opposite=Buy;
+    static constexpr bool better(int price1,int price2)
+    {
+        return price1<price2;
+    }
+    static constexpr bool crosses(int price,int oppositePrice)
+    {
+        return price<=oppositePrice;
+    }
+};
+
+/*
+ Enum to represent the kind of a trace event
+ MESSAGE_RECEIVED: a line was read from the input, arg is its length
+ PARSE_DONE: the line was split into words, arg is the number of words
+ MESSAGE_BEGIN, MESSAGE_END: processing of a command by the InputMachine, arg is its sequence
+ MATCH_BEGIN, MATCH_END: call to Match
+ FILL: a trade, arg is its quantity
+ BATCH_END: a batch of commands was processed and its output written, arg is the number of commands
+ ALLOC_SLOW: a container had to grow its memory, arg is its new number of elements
+ LOG_SHIPPED, LOG_ACKED: replication messages sent to and acknowledged by the standby, arg is the sequence
+ */
+enum class TraceType : uint8_t
+{
+    MESSAGE_RECEIVED,
+    PARSE_DONE,
+    MESSAGE_BEGIN,
+    MESSAGE_END,
+    MATCH_BEGIN,
+    MATCH_END,
+    FILL,
+    BATCH_END,
+    ALLOC_SLOW,
+    LOG_SHIPPED,
+    LOG_ACKED
+};
+
+/*
+ Struct of a trace event, 16 bytes so 4 of them fit in a cache line
+ ticks: timestamp read from the cycle counter
+ arg: argument of the event, its meaning depends on the type
+ type: TraceType of the event
+ */
+struct TraceEvent
+{
+    uint64_t ticks;
+    uint32_t arg;
+    TraceType type;
+};
+
+/*
+ Class to record trace events in a ring buffer per thread, the threads never share a buffer so recording is a few stores and one release store without locks or atomic read modify writes
+ When it overflows the ring keeps the last ringSize events, which are the ones needed to explain a slow message. The rings can be dumped at any time from another thread as Chrome trace JSON, that chrome://tracing and Perfetto open, or in a compact binary format
  */
-class Order
+class Tracer
 {
 private:
     /*
-      Fields
-      orderID: ID of the order, can be any sequence of printable characters
-      orderType: Type of the order, can be BUY or SELL
-      executionType: Execution type of the order, can be GFD (Good for Day) or IOC (Insert or Cancel)
-      priceBid: Integer value representing the price bid related to the order
-      quantity: Integer value representing the quantity of the order
-      turn: Turn in wich the order was inserted, is common for both BuyBook and SellBook
-     */
-    string orderID;
-    string orderType;
-    string executionType;
-    int priceBid;
-    int quantity;
-    int turn;
-public:
+     Struct of the ring buffer of a thread
+     events: the last ringSize events of the thread, the event number n is at position n&(ringSize-1)
+     head: number of events recorded by the thread, it is only written by its thread
+     tid: number of the thread in the trace
+     */
+    static const int ringSize=1<<16;
+    struct Ring
+    {
+        TraceEvent events[ringSize];
+        atomic<uint64_t> head{0};
+        int tid=0;
+    };
     /*
-     Default constructor
-     Initialize with initializer list
+     Fields
+     enabled: true if the events are recorded
+     dumpRequested: set by the signal handler to dump the trace at the next safe point
+     rings: ring buffer of every thread that recorded an event, they are kept after the thread exits so its events can still be dumped
+     ringsLock: mutex that protects rings, only taken the first time a thread records an event and when dumping
+     startTicks, startTime: cycle counter and clock when the tracer was enabled, used to convert the ticks to microseconds
+     path: file where the trace is dumped by default
      */
-    Order():orderID(""),orderType(""),executionType(""),priceBid(0),quantity(0),turn(0){};
+    atomic<bool> enabled{false};
+    atomic<bool> dumpRequested{false};
+    vector<unique_ptr<Ring>> rings;
+    mutex ringsLock;
+    uint64_t startTicks=0;
+    chrono::steady_clock::time_point startTime;
+    string path;
     /*
-     Function to create order with user defined parameters
-     @param ordID: ID of the order, can be any sequence of printable characters
-     @param ordType: Type of the order, can be BUY or SELL
-     @param execType: Execution type of the order, can be GFD (Good for Day) or IOC (Insert or Cancel)
-     @param priceB: Integer value representing the price bid related to the order
-     @param qty: Integer value representing the quantity of the order
+     Function to read the cycle counter, the steady clock in nanoseconds on the platforms without one
      */
-    void createOrder(string ordID, string ordType, string execType, int priceB,int qty,int tn)
+    static uint64_t ticks()
     {
-        orderID=ordID;
-        orderType=ordType;
-        executionType=execType;
-        priceBid=priceB;
-        quantity=qty;
-        turn=tn;
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
     }
     /*
-     Function to modify an existing order with user defined parameters
-     @param ordType: Type of the order, can be BUY or SELL
-     @param priceB: Integer value representing the price bid related to the order
-     @param qty: Integer value representing the quantity of the order
-     @param tn: Integer value representing the turn the order was inserted
+     Function to get the ring buffer of the calling thread, it is registered the first time
      */
-    void modifyOrder(string ordType, int priceB, int qty, int tn)
+    Ring& ring()
     {
-        orderType=ordType;
-        priceBid=priceB;
-        quantity=qty;
-        turn=tn;
+        thread_local Ring *threadRing=nullptr;
+        if(threadRing==nullptr)
+        {
+            lock_guard<mutex> guard(ringsLock);
+            rings.push_back(make_unique<Ring>());
+            threadRing=rings.back().get();
+            threadRing->tid=(int)rings.size();
+        }
+        return *threadRing;
     }
     /*
-     Function to get the value of field OrderID
+     Function to copy the events still in a ring. The events that its thread may have overwritten while they were copied, including the one it may be writing, are discarded, so the copy is consistent without stopping the thread
+     @param currRing: ring to copy
+     @return events of the ring, oldest first
      */
-    string getOrderID() const
+    static vector<TraceEvent> collect(const Ring &currRing)
     {
-        return orderID;
+        uint64_t head=currRing.head.load(memory_order_acquire);
+        uint64_t first=head>(uint64_t)ringSize?head-ringSize:0;
+        vector<TraceEvent> events;
+        events.reserve(head-first);
+        for(uint64_t n=first;n<head;n++)
+        {
+            events.push_back(currRing.events[n&(ringSize-1)]);
+        }
+        uint64_t after=currRing.head.load(memory_order_acquire);
+        if(after+1>first+ringSize)
+        {
+            size_t overwritten=min((size_t)(after+1-first-ringSize),events.size());
+            events.erase(events.begin(),events.begin()+overwritten);
+        }
+        return events;
     }
+public:
     /*
-     Function to get the value of field OrderType
+     Function to enable the tracer
+     @param dumpPath: file where the trace is dumped by the TRACE command without a path and on SIGUSR1
      */
-    string getOrderType() const
+    void enable(const string &dumpPath)
     {
-        return orderType;
+        path=dumpPath;
+        startTicks=ticks();
+        startTime=chrono::steady_clock::now();
+        enabled.store(true,memory_order_release);
     }
     /*
-     Function to get the value of field Price Bid
+     Function to check if the tracer is enabled
      */
-    int getPriceBid() const
+    bool isEnabled() const
     {
-        return priceBid;
+        return enabled.load(memory_order_relaxed);
     }
     /*
-     Function to get the value of field Quantity
+     Function to record an event in the ring of the calling thread, it does nothing if the tracer is disabled
+     @param type: TraceType of the event
+     @param arg: argument of the event
      */
-    int getQuantity() const
+    void record(TraceType type,uint64_t arg=0)
     {
-        return quantity;
+        if(!enabled.load(memory_order_relaxed))
+        {
+            return;
+        }
+        Ring &currRing=ring();
+        uint64_t head=currRing.head.load(memory_order_relaxed);
+        currRing.events[head&(ringSize-1)]={ticks(),(uint32_t)arg,type};
+        currRing.head.store(head+1,memory_order_release);
     }
     /*
-     Function to get the value of field Turn
+     Function to ask for a dump from a signal handler, it only sets a flag since the dump is not async signal safe
      */
-    int getTurn() const
+    void requestDump()
     {
-        return turn;
+        dumpRequested.store(true,memory_order_relaxed);
     }
     /*
-     Function to set the value of field Quantity
+     Function to dump the trace if it was asked for by a signal, called between commands
+     */
+    void dumpIfRequested()
+    {
+        if(dumpRequested.exchange(false,memory_order_relaxed))
+        {
+            dump("");
+        }
+    }
+    /*
+     Function to dump the events of all the threads, as Chrome trace JSON or in the binary format if the path ends in .bin
+     The binary format is the magic EXTRACE1, the nanoseconds per tick as a double, the tick when the tracer was enabled as a uint64, the number of threads as a uint32 and for each thread its tid and number of events as uint32 followed by the raw TraceEvent structs
+     @param dumpPath: file of the dump, empty to use the path given when the tracer was enabled
+     @return false if the tracer is disabled or the file can not be written
      */
-    void setQuantity(int qty)
+    bool dump(const string &dumpPath)
     {
-        quantity=qty;
+        if(!isEnabled())
+        {
+            return false;
+        }
+        string file=dumpPath==""?path:dumpPath;
+        double nsPerTick=(double)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now()-startTime).count()/max<uint64_t>(ticks()-startTicks,1);
+        vector<pair<int,vector<TraceEvent>>> threads;
+        {
+            lock_guard<mutex> guard(ringsLock);
+            for(auto &currRing:rings)
+            {
+                threads.push_back({currRing->tid,collect(*currRing)});
+            }
+        }
+        bool binary=file.size()>=4 && file.compare(file.size()-4,4,".bin")==0;
+        ofstream out(file,binary?ios::binary:ios::out);
+        if(binary)
+        {
+            uint32_t count=threads.size();
+            out.write("EXTRACE1",8);
+            out.write((const char*)&nsPerTick,sizeof(nsPerTick));
+            out.write((const char*)&startTicks,sizeof(startTicks));
+            out.write((const char*)&count,sizeof(count));
+            for(auto &thread:threads)
+            {
+                uint32_t header[2]={(uint32_t)thread.first,(uint32_t)thread.second.size()};
+                out.write((const char*)header,sizeof(header));
+                out.write((const char*)thread.second.data(),thread.second.size()*sizeof(TraceEvent));
+            }
+            return (bool)out;
+        }
+        static const char *names[]={"received","parsed","message","message","match","match","fill","batch","alloc","shipped","acked"};
+        out<<"{\"traceEvents\":["<<endl;
+        bool first=true;
+        out<<fixed<<setprecision(3);
+        for(auto &thread:threads)
+        {
+            for(const TraceEvent &event:thread.second)
+            {
+                char phase='i';
+                if(event.type==TraceType::MESSAGE_BEGIN || event.type==TraceType::MATCH_BEGIN)
+                {
+                    phase='B';
+                }
+                else if(event.type==TraceType::MESSAGE_END || event.type==TraceType::MATCH_END)
+                {
+                    phase='E';
+                }
+                double micros=((double)event.ticks-(double)startTicks)*nsPerTick/1000;
+                out<<(first?"":",\n")<<"{\"name\":\""<<names[(int)event.type]<<"\",\"ph\":\""<<phase<<"\",\"ts\":"<<micros<<",\"pid\":"<<getpid()<<",\"tid\":"<<thread.first;
+                if(phase=='i')
+                {
+                    out<<",\"s\":\"t\"";
+                }
+                out<<",\"args\":{\"arg\":"<<event.arg<<"}}";
+                first=false;
+            }
+        }
+        out<<"\n]}"<<endl;
+        return (bool)out;
     }
 };
+Tracer tracer;
+
+/*
+ Enum to represent the structures whose memory is accounted, each one is charged by the CountingAllocator of its containers
+ ARENA: arrays of the OrderArena
+ ORDER_IDS: heap buffers of the order ID and execution type strings of the arena, the short ones are stored inside the string and take no heap memory
+ ORDER_WINDOW: ring and bitmap of the window of the OrderIndex, allocated whole with the first numeric ID, a fixed cost that does not grow with the orders
+ ORDER_MAP: fallback hash table of the OrderIndex
+ LEVELS: maps of price levels of the QueueHandler
+ LEVEL_INDEX: containers of price levels (set or heap) and LevelBitmap words
+ LADDER: arrays of the PriceLadder
+ STOPS: maps of the StopBook
+ EXPIRIES: per slot links of the TimingWheel
+ OWNERS: owner names and per slot links of the OwnerLists
+ ANALYTICS: traded volume per price of the TradeAnalytics
+ PRINT: temporary maps used to print the book
+ */
+enum class MemoryAccount
+{
+    ARENA,
+    ORDER_IDS,
+    ORDER_WINDOW,
+    ORDER_MAP,
+    LEVELS,
+    LEVEL_INDEX,
+    LADDER,
+    STOPS,
+    EXPIRIES,
+    OWNERS,
+    ANALYTICS,
+    PRINT,
+    COUNT
+};
 
 /*
-  Overload operator less than, is used to provide order when using different STL containers like maps, sets, and priority queues,
-  Orders are compared based first on priceBid, and second on turn
-  @param order1: Order at the rhs of less than < operator. Declared as constant to avoid unwanted modification and as reference to avoid
-  copying the original object
-  @param order2: Order at the lhs of less than < operator. Declared as constant to avoid unwanted modification and as reference to avoid
-  copying the original object
+ Class to keep the memory used by each MemoryAccount, the live bytes, their high water mark and the number of allocations
+ It is only updated by the thread that runs the OrderBook, so the counters are plain integers
  */
-bool operator<(const Order& order1, const Order& order2)
+class MemoryUsage
 {
-    if(order1.getPriceBid()==order2.getPriceBid())
+private:
+    /*
+     Fields
+     live, peak, allocations: bytes allocated and not released yet, maximum of the live bytes and number of allocations of each account
+     totalLive, totalPeak: live bytes of all the accounts and their maximum
+     */
+    static const int accounts=(int)MemoryAccount::COUNT;
+    long long live[accounts]={};
+    long long peak[accounts]={};
+    long long allocations[accounts]={};
+    long long totalLive=0;
+    long long totalPeak=0;
+public:
+    /*
+     Function to charge an allocation to an account
+     @param account: MemoryAccount of the structure
+     @param bytes: size of the allocation
+     */
+    void allocated(MemoryAccount account,long long bytes)
     {
-        return order1.getTurn()<order2.getTurn();
+        int index=(int)account;
+        live[index]+=bytes;
+        peak[index]=max(peak[index],live[index]);
+        allocations[index]++;
+        totalLive+=bytes;
+        totalPeak=max(totalPeak,totalLive);
     }
-    return order1.getPriceBid() < order2.getPriceBid();
-}
+    /*
+     Function to give back the memory of an allocation to its account
+     @param account: MemoryAccount of the structure
+     @param bytes: size of the allocation
+     */
+    void released(MemoryAccount account,long long bytes)
+    {
+        live[(int)account]-=bytes;
+        totalLive-=bytes;
+    }
+    /*
+     Function to get the live bytes of all the accounts
+     */
+    long long total() const
+    {
+        return totalLive;
+    }
+    /*
+     Function to get the live bytes that grow with the orders, the total without the fixed cost of the ORDER_WINDOW account
+     */
+    long long variable() const
+    {
+        return totalLive-live[(int)MemoryAccount::ORDER_WINDOW];
+    }
+    /*
+     Function to print one line per account with the format name liveBytes peakBytes allocations, and the total with the format TOTAL liveBytes peakBytes
+     */
+    void print() const
+    {
+        static const char *names[]={"ARENA","ORDER_IDS","ORDER_WINDOW","ORDER_MAP","LEVELS","LEVEL_INDEX","LADDER","STOPS","EXPIRIES","OWNERS","ANALYTICS","PRINT"};
+        for(int index=0;index<accounts;index++)
+        {
+            cout<<names[index]<<" "<<live[index]<<" "<<peak[index]<<" "<<allocations[index]<<endl;
+        }
+        cout<<"TOTAL "<<totalLive<<" "<<totalPeak<<endl;
+    }
+};
+MemoryUsage memoryUsage;
+
 /*
-  Overload operator greater than, is used to provide order when using different STL containers like maps, sets, and priority queues
-  Orders are compared based first on priceBid, and second on turn
-  @param order1: Order at the rhs of greater than > operator. Declared as constant to avoid unwanted modification and as reference to avoid copying the original object
- @param order2: Order at the lhs of greater than > operator. Declared as constant to avoid unwanted modification and as reference to avoid copying the original object
+ Allocator that charges the memory of a container to a MemoryAccount and takes it from std::allocator, so the accounting adds two additions per allocation and no memory
+ @param T: type of the elements allocated
+ @param account: MemoryAccount of the container
  */
-bool operator>(const Order& order1, const Order& order2)
+template<class T,MemoryAccount account>
+struct CountingAllocator
 {
-    if(order1.getPriceBid()==order2.getPriceBid())
+    typedef T value_type;
+    template<class U>
+    struct rebind
+    {
+        typedef CountingAllocator<U,account> other;
+    };
+    CountingAllocator()=default;
+    template<class U>
+    CountingAllocator(const CountingAllocator<U,account>&){}
+    T* allocate(size_t n)
+    {
+        memoryUsage.allocated(account,n*sizeof(T));
+        return allocator<T>().allocate(n);
+    }
+    void deallocate(T *pointer,size_t n)
+    {
+        memoryUsage.released(account,n*sizeof(T));
+        allocator<T>().deallocate(pointer,n);
+    }
+    template<class U>
+    bool operator==(const CountingAllocator<U,account>&) const
+    {
+        return true;
+    }
+    template<class U>
+    bool operator!=(const CountingAllocator<U,account>&) const
     {
-        return order1.getTurn()<order2.getTurn();
+        return false;
     }
-    return order1.getPriceBid() > order2.getPriceBid();
+};
+template<class T,MemoryAccount account>
+using CountedVector=vector<T,CountingAllocator<T,account>>;
+template<class Key,class Value,MemoryAccount account>
+using CountedHashMap=unordered_map<Key,Value,hash<Key>,equal_to<Key>,CountingAllocator<pair<const Key,Value>,account>>;
+
+/*
+ Function to get the heap memory of a string, 0 if it is short enough to be stored inside the string
+ @param text: string to measure
+ */
+inline long long heapBytes(const string &text)
+{
+    static const size_t inlineCapacity=string().capacity();
+    return text.capacity()>inlineCapacity?text.capacity()+1:0;
 }
+
 /*
- Overload operator equal to, is used when using different STL algorithms like find and erase
- @param order1: Order at the rhs of greater than > operator. Declared as constant to avoid unwanted modification and as reference to avoid copying the original object
- @param order2: Order at the lhs of greater than > operator. Declared as constant to avoid unwanted modification and as reference to avoid copying the original object
+ Function to mix the bits of a 64 bit value (splitmix64 finalizer), used to build the hash of the orders
+ @param value: value to mix
  */
+inline unsigned long long hashMix(unsigned long long value)
+{
+    value=(value^(value>>30))*0xbf58476d1ce4e5b9ULL;
+    value=(value^(value>>27))*0x94d049bb133111ebULL;
+    return value^(value>>31);
+}
 
-bool operator==(const Order& order1, const Order& order2)
+/*
+ Function to hash an order ID with FNV-1a, so the hash of the book does not depend on the standard library implementation
+ @param ordID: ID of the order
+ */
+inline unsigned long long hashID(const string &ordID)
 {
-    return order1.getOrderID() == order2.getOrderID();
+    unsigned long long hash=0xcbf29ce484222325ULL;
+    for(unsigned char c:ordID)
+    {
+        hash=(hash^c)*0x100000001b3ULL;
+    }
+    return hash;
 }
 
 /*
- Class to works as a handler for both buyPriority queue and sellPriority queue
- buyPriority queue is implemented as a decreasing order set recreating the functionality of a maximum heap
- sellPriority queue is implemented as a increasing order set recreating the functionality of a minimum heap
- for performance reasons both buyPriority and sellPriority are implemented as set which internally are implemented as Binary Search Trees (BST)
- BST have insert, delete, and find operations in O(logN)
- Priority Queues also known as heaps have insert and delete from the top in O(1) but when deleting and finding elements from the middle or the back the worst case scenario is O(N) for that reason I didnt used this data structure
+ Class to store the data (fields) of all the orders as a structure of arrays, every order lives in a slot and each field is stored in its own array indexed by that slot
+ The fields are split in hot fields, used by the matching and by the comparisons in the containers, and cold fields, only needed to print or to validate the input. This way matching only pulls the small hot arrays into the cache instead of the whole order with its strings
+ The slots of the canceled orders are kept in a free list and reused by the new orders. The arrays are charged to the ARENA account and the heap buffers of the strings to the ORDER_IDS account
+ getters are implemented as constant functions to avoid unwanted modification of fields
  */
+class OrderArena
+{
+private:
+    template<class T>
+    using ArenaVector=CountedVector<T,MemoryAccount::ARENA>;
+    /*
+     Hot fields
+     priceBid: Integer value representing the price bid related to the order
+     quantity: Integer value representing the remaining quantity of the order, it is 0 for the free slots
+     turn: Turn in wich the order was inserted, is common for both BuyBook and SellBook
+     next, prev: Slots of the next and previous orders in the same price level, -1 at the ends of the level
+     */
+    ArenaVector<int> priceBid;
+    ArenaVector<int> quantity;
+    ArenaVector<int> turn;
+    ArenaVector<int> next;
+    ArenaVector<int> prev;
+    /*
+     Cold fields
+     orderID: ID of the order, can be any sequence of printable characters
+     originalQuantity: Integer value representing the quantity of the order when it was inserted or modified
+     side: Side of the order, can be BUY or SELL
+     executionType: Execution type of the order, can be GFD (Good for Day), IOC (Insert or Cancel), ICEBERG, GTT (Good Till Time), STOP or STOPLIMIT, MARKET orders are never stored
+     peakQuantity: Integer value representing the quantity displayed by an ICEBERG order each time it is refilled, 0 for the other orders
+     hiddenQuantity: Integer value representing the quantity of an ICEBERG order not displayed yet
+     triggerPrice: Integer value representing the trigger price of a STOP or STOPLIMIT order waiting off the book, 0 for the other orders
+     expiryTime: tick of the engine clock when a GTT order expires, 0 for the other orders
+     idHash: hash of the order ID, computed once when the order is created
+     freeSlots: slots released by the orders that left the book, ready to be reused
+     */
+    ArenaVector<string> orderID;
+    ArenaVector<int> originalQuantity;
+    ArenaVector<SideType> side;
+    ArenaVector<string> executionType;
+    ArenaVector<int> peakQuantity;
+    ArenaVector<int> hiddenQuantity;
+    ArenaVector<int> triggerPrice;
+    ArenaVector<long long> expiryTime;
+    ArenaVector<unsigned long long> idHash;
+    ArenaVector<int> freeSlots;
+    /*
+     Function to assign a string field, the change of its heap memory is charged to the ORDER_IDS account. A string keeps its buffer when it is cleared, so the buffer of a free slot is reused by the next order
+     @param field: string of the slot
+     @param value: new value of the string
+     */
+    static void assignString(string &field,const string &value)
+    {
+        long long before=heapBytes(field);
+        field=value;
+        long long after=heapBytes(field);
+        if(after!=before)
+        {
+            memoryUsage.released(MemoryAccount::ORDER_IDS,before);
+            memoryUsage.allocated(MemoryAccount::ORDER_IDS,after);
+        }
+    }
+public:
+    /*
+     Destructor, it gives back the heap memory of the strings to the ORDER_IDS account
+     */
+    ~OrderArena()
+    {
+        for(size_t slot=0;slot<orderID.size();slot++)
+        {
+            memoryUsage.released(MemoryAccount::ORDER_IDS,heapBytes(orderID[slot])+heapBytes(executionType[slot]));
+        }
+    }
+    /*
+     Function to create order with user defined parameters in a free slot, it grows the arrays if there is no free slot
+     @param ordID: ID of the order, can be any sequence of printable characters
+     @param sd: Side of the order, can be BUY or SELL
+     @param execType: Execution type of the order, can be GFD (Good for Day), IOC (Insert or Cancel), ICEBERG, GTT (Good Till Time), STOP or STOPLIMIT
+     @param priceB: Integer value representing the price bid related to the order
+     @param qty: Integer value representing the quantity of the order
+     @param tn: Integer value representing the turn the order was inserted
+     @return slot where the order was created
+     */
+    int createOrder(const string &ordID, SideType sd, const string &execType, int priceB,int qty,int tn)
+    {
+        int slot;
+        if(!freeSlots.empty())
+        {
+            slot=freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else
+        {
+            slot=(int)priceBid.size();
+            if(priceBid.size()==priceBid.capacity())
+            {
+                tracer.record(TraceType::ALLOC_SLOW,slot+1);
+            }
+            priceBid.push_back(0);
+            quantity.push_back(0);
+            turn.push_back(0);
+            next.push_back(-1);
+            prev.push_back(-1);
+            orderID.emplace_back();
+            originalQuantity.push_back(0);
+            side.push_back(SideType::BUY);
+            executionType.emplace_back();
+            peakQuantity.push_back(0);
+            hiddenQuantity.push_back(0);
+            triggerPrice.push_back(0);
+            expiryTime.push_back(0);
+            idHash.push_back(0);
+        }
+        assignString(orderID[slot],ordID);
+        side[slot]=sd;
+        assignString(executionType[slot],execType);
+        originalQuantity[slot]=qty;
+        peakQuantity[slot]=0;
+        hiddenQuantity[slot]=0;
+        triggerPrice[slot]=0;
+        expiryTime[slot]=0;
+        idHash[slot]=hashID(ordID);
+        priceBid[slot]=priceB;
+        quantity[slot]=qty;
+        turn[slot]=tn;
+        return slot;
+    }
+    /*
+     Function to turn an order just created into an ICEBERG order, only the peak quantity is displayed and the rest is kept hidden
+     @param slot: slot of the order
+     @param peak: Integer value representing the quantity displayed each time
+     */
+    void makeIceberg(int slot,int peak)
+    {
+        peakQuantity[slot]=peak;
+        hiddenQuantity[slot]=quantity[slot]-min(peak,quantity[slot]);
+        quantity[slot]-=hiddenQuantity[slot];
+    }
+    /*
+     Function to take the next peak from the hidden quantity of an ICEBERG order
+     @param slot: slot of the order
+     @return quantity to display, 0 if there is no hidden quantity left
+     */
+    int takeHidden(int slot)
+    {
+        int displayed=min(peakQuantity[slot],hiddenQuantity[slot]);
+        hiddenQuantity[slot]-=displayed;
+        return displayed;
+    }
+    /*
+     Function to modify an existing order with user defined parameters, an ICEBERG order keeps its peak and only displays that quantity
+     @param slot: slot of the order
+     @param sd: Side of the order, can be BUY or SELL
+     @param priceB: Integer value representing the price bid related to the order
+     @param qty: Integer value representing the quantity of the order
+     @param tn: Integer value representing the turn the order was inserted
+     */
+    void modifyOrder(int slot, SideType sd, int priceB, int qty, int tn)
+    {
+        side[slot]=sd;
+        originalQuantity[slot]=qty;
+        priceBid[slot]=priceB;
+        quantity[slot]=qty;
+        turn[slot]=tn;
+        if(peakQuantity[slot]>0)
+        {
+            makeIceberg(slot,peakQuantity[slot]);
+        }
+    }
+    /*
+     Function to release the slot of an order that left the book, the quantity is set to 0 to mark the slot as free
+     @param slot: slot of the order
+     */
+    void releaseOrder(int slot)
+    {
+        quantity[slot]=0;
+        peakQuantity[slot]=0;
+        hiddenQuantity[slot]=0;
+        triggerPrice[slot]=0;
+        expiryTime[slot]=0;
+        orderID[slot].clear();
+        freeSlots.push_back(slot);
+    }
+    /*
+     Function to get the number of slots of the arena, free or not
+     */
+    int slots() const
+    {
+        return (int)priceBid.size();
+    }
+    /*
+     Function to get the number of free slots of the arena
+     */
+    int freeCount() const
+    {
+        return (int)freeSlots.size();
+    }
+    /*
+     Function to check if a slot holds an order, the slots are not reused while matching so it can be used to know if an order was fully traded
+     */
+    bool isLive(int slot) const
+    {
+        return quantity[slot]>0;
+    }
+    /*
+     Function to get the value of field OrderID
+     */
+    const string& getOrderID(int slot) const
+    {
+        return orderID[slot];
+    }
+    /*
+     Function to get the value of field Side
+     */
+    SideType getSide(int slot) const
+    {
+        return side[slot];
+    }
+    /*
+     Function to get the value of field Price Bid
+     */
+    int getPriceBid(int slot) const
+    {
+        return priceBid[slot];
+    }
+    /*
+     Function to get the value of field Quantity
+     */
+    int getQuantity(int slot) const
+    {
+        return quantity[slot];
+    }
+    /*
+     Function to get the value of field Turn
+     */
+    int getTurn(int slot) const
+    {
+        return turn[slot];
+    }
+    /*
+     Function to check if an order is an ICEBERG order
+     */
+    bool isIceberg(int slot) const
+    {
+        return peakQuantity[slot]>0;
+    }
+    /*
+     Function to check if an order is a STOP or STOPLIMIT order waiting for its trigger off the book
+     */
+    bool isStop(int slot) const
+    {
+        return triggerPrice[slot]>0;
+    }
+    /*
+     Function to get the value of field Trigger Price
+     */
+    int getTriggerPrice(int slot) const
+    {
+        return triggerPrice[slot];
+    }
+    /*
+     Function to set the value of field Trigger Price, 0 once the order is triggered
+     */
+    void setTriggerPrice(int slot,int price)
+    {
+        triggerPrice[slot]=price;
+    }
+    /*
+     Function to get the hash of an order resting in the book, it covers its ID, side, price, remaining quantity and turn
+     */
+    unsigned long long getHash(int slot) const
+    {
+        unsigned long long hash=hashMix(idHash[slot]^(unsigned int)priceBid[slot]);
+        hash=hashMix(hash^(((unsigned long long)(unsigned int)quantity[slot]<<1)|(side[slot]==SideType::SELL)));
+        return hashMix(hash^(unsigned int)turn[slot]);
+    }
+    /*
+     Function to check if an order has an expiry time
+     */
+    bool hasExpiry(int slot) const
+    {
+        return expiryTime[slot]>0;
+    }
+    /*
+     Function to get the value of field Expiry Time
+     */
+    long long getExpiryTime(int slot) const
+    {
+        return expiryTime[slot];
+    }
+    /*
+     Function to set the value of field Expiry Time
+     */
+    void setExpiryTime(int slot,long long expiry)
+    {
+        expiryTime[slot]=expiry;
+    }
+    /*
+     Function to get the value of field Hidden Quantity
+     */
+    int getHiddenQuantity(int slot) const
+    {
+        return hiddenQuantity[slot];
+    }
+    /*
+     Function to get the slot of the next order in the same price level, -1 if it is the last one
+     */
+    int getNext(int slot) const
+    {
+        return next[slot];
+    }
+    /*
+     Function to set the value of field Quantity
+     */
+    void setQuantity(int slot,int qty)
+    {
+        quantity[slot]=qty;
+    }
+    /*
+     Function to set the value of field Turn
+     */
+    void setTurn(int slot,int tn)
+    {
+        turn[slot]=tn;
+    }
+    friend class QueueHandler;
+};
+
+/*
+ Struct to represent a price level of one side, the orders of the level form a doubly linked list through the next and prev fields of the OrderArena, in the order they have to be traded
+ price: Integer value representing the price of the level
+ head, tail: Slots of the first and last orders of the level, -1 if the level is empty
+ count: Number of orders in the level
+ icebergs: Number of ICEBERG orders in the level, a level with icebergs can not be consumed in one step since they are refilled
+ quantity: Sum of the displayed quantities of the orders in the level
+ hash: XOR of the hashes of the orders in the level, so a whole level can be removed from the hash of the book in O(1)
+ */
+struct Level
+{
+    int price=0;
+    int head=-1;
+    int tail=-1;
+    int count=0;
+    int icebergs=0;
+    long long quantity=0;
+    unsigned long long hash=0;
+};
+typedef CountedHashMap<int,Level,MemoryAccount::LEVELS> LevelMap;
+
+/*
+ Comparator used to provide order to the containers of price levels of each side, the template is instantiated once per side
+ Levels are compared based on price using the constexpr better function of the side, the time priority is given by the order of the list inside each level
+ @param level1: Level at the lhs of the comparison
+ @param level2: Level at the rhs of the comparison
+ */
+template<class Side>
+struct Priority
+{
+    bool operator()(const Level* level1, const Level* level2) const
+    {
+        return Side::better(level1->price,level2->price);
+    }
+};
+
+/*
+ Class to store the counters of the work done by the engine in the hot path, every counter is a plain integer incremented inline so they are cheap enough to be always enabled
+ The counters are printed with the STATS command and help to decide which container fits best the order flow, for example how many price levels are inserted and erased from the containers and how many quantity changes are applied in place
+ */
+class Stats
+{
+public:
+    /*
+     Fields
+     inserts: Number of price levels inserted in the buyPriority and sellPriority containers, indexed by side
+     erases: Number of price levels deleted from the buyPriority and sellPriority containers, indexed by side
+     mapLookups: Number of lookups done in the orderMap
+     matchCalls: Number of times Match was called
+     matchIterations: Number of iterations of the Match loop, including the last one that finds no trade
+     partialFills: Number of fills that left a reminder quantity in the traded order
+     fullFills: Number of fills that completed the traded order
+     updatesInPlace: Number of times UpdateOrder changed the quantity of an order without touching the containers
+     iocKilled: Number of IOC orders canceled without trading any quantity
+     massCanceled: Number of orders canceled by the MASSCANCEL command
+     ordersExpired: Number of GTT orders canceled by the engine clock
+     stopsTriggered: Number of STOP and STOPLIMIT orders triggered by the last trade price
+     modifiesInPlace: Number of MODIFY commands applied in place since they only decreased the quantity
+     icebergRefills: Number of times an ICEBERG order was refilled from its hidden quantity
+     marketOrders: Number of MARKET orders executed
+     levelsSwept: Number of price levels consumed entirely by MARKET orders in one pass
+     tombstones: Number of empty price levels left in the containers by the lazy deletion mode
+     tombstonesDiscarded: Number of empty price levels removed when they reached the top of the containers
+     compactions: Number of times the containers were rebuilt to remove the empty price levels
+     indexSwitches: Number of times a side moved its price levels between its container and the direct index of its PriceLadder and LevelBitmap
+     peakDepth: Maximum number of orders resting at the same time in each side, indexed by side
+     */
+    long long inserts[2]={0,0};
+    long long erases[2]={0,0};
+    long long mapLookups=0;
+    long long matchCalls=0;
+    long long matchIterations=0;
+    long long partialFills=0;
+    long long fullFills=0;
+    long long updatesInPlace=0;
+    long long iocKilled=0;
+    long long massCanceled=0;
+    long long ordersExpired=0;
+    long long stopsTriggered=0;
+    long long modifiesInPlace=0;
+    long long icebergRefills=0;
+    long long marketOrders=0;
+    long long levelsSwept=0;
+    long long tombstones=0;
+    long long tombstonesDiscarded=0;
+    long long compactions=0;
+    long long indexSwitches=0;
+    long long peakDepth[2]={0,0};
+    /*
+     Function to print all the counters, one per line with the format NAME value
+     */
+    void PrintStats() const
+    {
+        cout<<"STATS: "<<endl;
+        cout<<"BUY_INSERTS "<<inserts[Buy::index]<<endl;
+        cout<<"SELL_INSERTS "<<inserts[Sell::index]<<endl;
+        cout<<"BUY_ERASES "<<erases[Buy::index]<<endl;
+        cout<<"SELL_ERASES "<<erases[Sell::index]<<endl;
+        cout<<"MAP_LOOKUPS "<<mapLookups<<endl;
+        cout<<"MATCH_CALLS "<<matchCalls<<endl;
+        cout<<"MATCH_ITERATIONS "<<matchIterations<<endl;
+        cout<<"PARTIAL_FILLS "<<partialFills<<endl;
+        cout<<"FULL_FILLS "<<fullFills<<endl;
+        cout<<"UPDATES_IN_PLACE "<<updatesInPlace<<endl;
+        cout<<"IOC_KILLED "<<iocKilled<<endl;
+        cout<<"MASS_CANCELED "<<massCanceled<<endl;
+        cout<<"ORDERS_EXPIRED "<<ordersExpired<<endl;
+        cout<<"STOPS_TRIGGERED "<<stopsTriggered<<endl;
+        cout<<"MODIFIES_IN_PLACE "<<modifiesInPlace<<endl;
+        cout<<"ICEBERG_REFILLS "<<icebergRefills<<endl;
+        cout<<"MARKET_ORDERS "<<marketOrders<<endl;
+        cout<<"LEVELS_SWEPT "<<levelsSwept<<endl;
+        cout<<"TOMBSTONES "<<tombstones<<endl;
+        cout<<"TOMBSTONES_DISCARDED "<<tombstonesDiscarded<<endl;
+        cout<<"COMPACTIONS "<<compactions<<endl;
+        cout<<"INDEX_SWITCHES "<<indexSwitches<<endl;
+        cout<<"PEAK_BUY_DEPTH "<<peakDepth[Buy::index]<<endl;
+        cout<<"PEAK_SELL_DEPTH "<<peakDepth[Sell::index]<<endl;
+    }
+};
+
+/*
+ Kernels used by the PriceLadder to scan and update the quantities of contiguous price levels, each one has a scalar version and an AVX2 version that processes 4 levels per instruction. The quantities are 64 bit, a level holding several orders can go over INT_MAX and a 32 bit cell would wrap, even to 0 making the level look empty
+ findForward: returns the first index in [from,to) with a non zero quantity, or -1 if all of them are empty
+ findBackward: returns the last index in [from,to) with a non zero quantity, or -1 if all of them are empty
+ sumLevels: returns the sum of the quantities in [from,to)
+ subtractLevels: subtracts amounts[i] from levels[i] for every i in [0,count)
+ */
+int findForwardScalar(const long long *levels,int from,int to)
+{
+    for(int i=from;i<to;i++)
+    {
+        if(levels[i]!=0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+int findBackwardScalar(const long long *levels,int from,int to)
+{
+    for(int i=to-1;i>=from;i--)
+    {
+        if(levels[i]!=0)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+long long sumLevelsScalar(const long long *levels,int from,int to)
+{
+    long long total=0;
+    for(int i=from;i<to;i++)
+    {
+        total+=levels[i];
+    }
+    return total;
+}
+void subtractLevelsScalar(long long *levels,const long long *amounts,int count)
+{
+    for(int i=0;i<count;i++)
+    {
+        levels[i]-=amounts[i];
+    }
+}
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+int findForwardAVX2(const long long *levels,int from,int to)
+{
+    const __m256i zero=_mm256_setzero_si256();
+    int i=from;
+    for(;i+4<=to;i+=4)
+    {
+        __m256i empty=_mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(levels+i)),zero);
+        int mask=~_mm256_movemask_pd(_mm256_castsi256_pd(empty))&0xF;
+        if(mask!=0)
+        {
+            return i+__builtin_ctz(mask);
+        }
+    }
+    return findForwardScalar(levels,i,to);
+}
+__attribute__((target("avx2")))
+int findBackwardAVX2(const long long *levels,int from,int to)
+{
+    const __m256i zero=_mm256_setzero_si256();
+    int i=to;
+    for(;i-4>=from;i-=4)
+    {
+        __m256i empty=_mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(levels+i-4)),zero);
+        int mask=~_mm256_movemask_pd(_mm256_castsi256_pd(empty))&0xF;
+        if(mask!=0)
+        {
+            return i-4+31-__builtin_clz(mask);
+        }
+    }
+    return findBackwardScalar(levels,from,i);
+}
+__attribute__((target("avx2")))
+long long sumLevelsAVX2(const long long *levels,int from,int to)
+{
+    __m256i total=_mm256_setzero_si256();
+    int i=from;
+    for(;i+4<=to;i+=4)
+    {
+        total=_mm256_add_epi64(total,_mm256_loadu_si256((const __m256i*)(levels+i)));
+    }
+    long long lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes,total);
+    return lanes[0]+lanes[1]+lanes[2]+lanes[3]+sumLevelsScalar(levels,i,to);
+}
+__attribute__((target("avx2")))
+void subtractLevelsAVX2(long long *levels,const long long *amounts,int count)
+{
+    int i=0;
+    for(;i+4<=count;i+=4)
+    {
+        __m256i curr=_mm256_loadu_si256((const __m256i*)(levels+i));
+        __m256i amount=_mm256_loadu_si256((const __m256i*)(amounts+i));
+        _mm256_storeu_si256((__m256i*)(levels+i),_mm256_sub_epi64(curr,amount));
+    }
+    subtractLevelsScalar(levels+i,amounts+i,count-i);
+}
+#endif
+
+/*
+ Struct to hold the kernels chosen at runtime, the AVX2 versions are used only if the CPU supports them, otherwise the scalar versions are used
+ */
+struct LadderKernels
+{
+    int (*findForward)(const long long*,int,int);
+    int (*findBackward)(const long long*,int,int);
+    long long (*sumLevels)(const long long*,int,int);
+    void (*subtractLevels)(long long*,const long long*,int);
+};
+LadderKernels selectLadderKernels()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if(__builtin_cpu_supports("avx2"))
+    {
+        return {findForwardAVX2,findBackwardAVX2,sumLevelsAVX2,subtractLevelsAVX2};
+    }
+#endif
+    return {findForwardScalar,findBackwardScalar,sumLevelsScalar,subtractLevelsScalar};
+}
+const LadderKernels ladderKernels=selectLadderKernels();
+
+/*
+ Class to store the aggregated quantity of every price level of one side in a dense array indexed by price, the position i stores the quantity of the price base+i
+ The array grows to cover the prices inserted, if the distance between the lowest and highest price goes over maxSpan the ladder stops being dense until the side gets empty. While it is not dense the levels are found with the index chosen for the side by the IndexMode, the set or heap of the build or the LevelBitmap when the side is indexed directly, see QueueHandler::nextLevel
+ Finding the next non empty level and adding up the quantities of several levels are linear scans done by the ladderKernels
+ */
+class PriceLadder
+{
+private:
+    /*
+     Fields
+     levels: aggregated quantity of each price level, the position i stores the price base+i
+     base: price stored at position 0 of levels
+     total: total quantity stored in the ladder, used to know when the side is empty
+     dense: false if the prices inserted do not fit in maxSpan levels
+     maxSpan: maximum number of levels stored in the array
+     maxSweepSpan: maximum distance between the levels removed by removeLevels to subtract them in one pass
+     */
+    CountedVector<long long,MemoryAccount::LADDER> levels;
+    int base=0;
+    long long total=0;
+    bool dense=true;
+    static const int maxSpan=1<<22;
+    static const int maxSweepSpan=1<<16;
+    /*
+     Function to grow the array so the price can be stored, it doubles the size in the needed direction to keep the amortized cost constant
+     @param price: price that must be covered by the array
+     */
+    void grow(int price)
+    {
+        if(levels.empty())
+        {
+            base=price;
+            levels.assign(64,0);
+            return;
+        }
+        long long size=levels.size();
+        if(price<base)
+        {
+            long long newBase=max(1LL,min((long long)price,base-size));
+            if(base+size-newBase>maxSpan)
+            {
+                newBase=price;
+            }
+            if(base+size-newBase>maxSpan)
+            {
+                dense=false;
+                return;
+            }
+            levels.insert(levels.begin(),base-newBase,0);
+            base=newBase;
+        }
+        else
+        {
+            if((long long)price-base+1>maxSpan)
+            {
+                dense=false;
+                return;
+            }
+            levels.resize(min(max((long long)price-base+1,2*size),(long long)maxSpan),0);
+        }
+    }
+public:
+    /*
+     Function to check if the ladder covers all the prices of the side
+     */
+    bool isDense() const
+    {
+        return dense;
+    }
+    /*
+     Function to get the number of prices covered by the array
+     */
+    int span() const
+    {
+        return (int)levels.size();
+    }
+    /*
+     Function to add quantity to a price level
+     @param price: Integer value representing the price of the level
+     @param qty: Integer value representing the quantity to add
+     */
+    void add(int price,int qty)
+    {
+        total+=qty;
+        if(!dense)
+        {
+            return;
+        }
+        if(price<base || price-base>=(int)levels.size())
+        {
+            grow(price);
+            if(!dense)
+            {
+                return;
+            }
+        }
+        levels[price-base]+=qty;
+    }
+    /*
+     Function to remove quantity from a price level, when the side gets empty the array is reset so the ladder can be dense again
+     @param price: Integer value representing the price of the level
+     @param qty: Integer value representing the quantity to remove
+     */
+    void remove(int price,int qty)
+    {
+        total-=qty;
+        if(total==0)
+        {
+            levels.clear();
+            dense=true;
+            return;
+        }
+        if(dense)
+        {
+            levels[price-base]-=qty;
+        }
+    }
+    /*
+     Function to subtract quantities from count contiguous price levels in one pass, used when a sweep consumes several levels
+     @param fromPrice: price of the first level
+     @param amounts: quantities to subtract from each level starting at fromPrice
+     @param count: number of levels
+     */
+    void subtract(int fromPrice,const long long *amounts,int count)
+    {
+        total-=ladderKernels.sumLevels(amounts,0,count);
+        if(total==0)
+        {
+            levels.clear();
+            dense=true;
+            return;
+        }
+        if(dense)
+        {
+            ladderKernels.subtractLevels(levels.data()+fromPrice-base,amounts,count);
+        }
+    }
+    /*
+     Function to remove several price levels consumed by a sweep, the levels are contiguous in the ladder so when they are close enough their quantities are subtracted in one pass with the subtractLevels kernel
+     @param consumed: price and quantity of each level removed, sorted by price in any direction
+     */
+    void removeLevels(const vector<pair<int,int>> &consumed)
+    {
+        if(consumed.empty())
+        {
+            return;
+        }
+        int lowest=min(consumed.front().first,consumed.back().first);
+        int highest=max(consumed.front().first,consumed.back().first);
+        if(!dense || highest-lowest>=maxSweepSpan)
+        {
+            for(auto &currLevel:consumed)
+            {
+                remove(currLevel.first,currLevel.second);
+            }
+            return;
+        }
+        vector<long long> amounts(highest-lowest+1,0);
+        for(auto &currLevel:consumed)
+        {
+            amounts[currLevel.first-lowest]=currLevel.second;
+        }
+        subtract(lowest,amounts.data(),(int)amounts.size());
+    }
+    /*
+     Function to get the aggregated quantity of a price level
+     @param price: Integer value representing the price of the level
+     */
+    long long quantityAt(int price) const
+    {
+        if(price<base || price-base>=(int)levels.size())
+        {
+            return 0;
+        }
+        return levels[price-base];
+    }
+    /*
+     Function to add up the quantities of all the levels between two prices, both included
+     @param fromPrice: lowest price of the range
+     @param toPrice: highest price of the range
+     */
+    long long sumRange(int fromPrice,int toPrice) const
+    {
+        int from=max(fromPrice-base,0);
+        int to=min(toPrice-base+1,(int)levels.size());
+        if(from>=to)
+        {
+            return 0;
+        }
+        return ladderKernels.sumLevels(levels.data(),from,to);
+    }
+    /*
+     Function to find the lowest non empty level, it returns 0 if there is none
+     */
+    int lowest() const
+    {
+        int idx=ladderKernels.findForward(levels.data(),0,(int)levels.size());
+        return idx<0?0:base+idx;
+    }
+    /*
+     Function to find the highest non empty level, it returns 0 if there is none. The search is inclusive, unlike below, so a level priced INT_MAX is found
+     */
+    int highest() const
+    {
+        int idx=ladderKernels.findBackward(levels.data(),0,(int)levels.size());
+        return idx<0?0:base+idx;
+    }
+    /*
+     Function to find the lowest non empty level with a price greater than the given price, it returns 0 if there is none
+     @param price: Integer value representing the price where the search starts
+     */
+    int above(int price) const
+    {
+        int idx=ladderKernels.findForward(levels.data(),max(price-base+1,0),(int)levels.size());
+        return idx<0?0:base+idx;
+    }
+    /*
+     Function to find the highest non empty level with a price lower than the given price, it returns 0 if there is none
+     @param price: Integer value representing the price where the search starts
+     */
+    int below(int price) const
+    {
+        int idx=ladderKernels.findBackward(levels.data(),0,(int)min((long long)price-base,(long long)levels.size()));
+        return idx<0?0:base+idx;
+    }
+};
+
+/*
+ Class to index the non empty price levels of one side in a hierarchical bitmap, used when the prices are too spread for a PriceLadder
+ Each layer has one bit per word of the layer below, so a word covers 64 prices in the first layer, 64*64 in the second one and so on, and 6 layers cover every positive int price. Finding the next non empty price goes up until a word has a set bit past the position and down again taking the lowest or highest set bit of one word per layer, a tzcnt or lzcnt each
+ The words of each layer are kept in a hash table by their index, so only the ranges of prices with levels take memory
+ */
+class LevelBitmap
+{
+private:
+    /*
+     Fields
+     layers: number of layers of the bitmap
+     words: non zero words of each layer, indexed by layer and then by the index of the word. The bit i of the word k of a layer is set if the unit 64*k+i of the layer has a price, the units of the first layer are prices and the units of the next ones are words of the layer below
+     */
+    static const int layers=6;
+    CountedHashMap<long long,uint64_t,MemoryAccount::LEVEL_INDEX> words[layers];
+    /*
+     Function to get a word of a layer, 0 if it has no bits set
+     @param layer: layer of the word
+     @param key: index of the word in the layer
+     */
+    uint64_t word(int layer,long long key) const
+    {
+        auto fitr=words[layer].find(key);
+        return fitr==words[layer].end()?0:fitr->second;
+    }
+public:
+    /*
+     Function to mark a price as non empty, the words above are only touched if the word below was empty
+     @param price: Integer value representing the price of the level
+     */
+    void add(int price)
+    {
+        long long unit=price;
+        for(int layer=0;layer<layers;layer++)
+        {
+            uint64_t &currWord=words[layer][unit>>6];
+            bool wasEmpty=currWord==0;
+            currWord|=1ULL<<(unit&63);
+            if(!wasEmpty)
+            {
+                return;
+            }
+            unit>>=6;
+        }
+    }
+    /*
+     Function to mark a price as empty, the words above are only touched if the word below gets empty
+     @param price: Integer value representing the price of the level
+     */
+    void remove(int price)
+    {
+        long long unit=price;
+        for(int layer=0;layer<layers;layer++)
+        {
+            auto fitr=words[layer].find(unit>>6);
+            if(fitr==words[layer].end())
+            {
+                return;
+            }
+            fitr->second&=~(1ULL<<(unit&63));
+            if(fitr->second!=0)
+            {
+                return;
+            }
+            words[layer].erase(fitr);
+            unit>>=6;
+        }
+    }
+    /*
+     Function to find the lowest non empty price, it returns 0 if there is none
+     */
+    int lowest() const
+    {
+        return above(0);
+    }
+    /*
+     Function to find the highest non empty price, it returns 0 if there is none. The search starts past INT_MAX so a level priced INT_MAX is found
+     */
+    int highest() const
+    {
+        return below((long long)INT_MAX+1);
+    }
+    /*
+     Function to find the lowest non empty price greater than the given price, it returns 0 if there is none
+     @param price: Integer value representing the price where the search starts
+     */
+    int above(int price) const
+    {
+        long long unit=(long long)price+1;
+        for(int layer=0;layer<layers;layer++)
+        {
+            uint64_t currWord=word(layer,unit>>6)&(~0ULL<<(unit&63));
+            if(currWord!=0)
+            {
+                unit=((unit>>6)<<6)|__builtin_ctzll(currWord);
+                for(int lower=layer-1;lower>=0;lower--)
+                {
+                    unit=(unit<<6)|__builtin_ctzll(word(lower,unit));
+                }
+                return (int)unit;
+            }
+            unit=(unit>>6)+1;
+        }
+        return 0;
+    }
+    /*
+     Function to find the highest non empty price lower than the given price, it returns 0 if there is none
+     @param price: Integer value representing the price where the search starts, it can be INT_MAX+1
+     */
+    int below(long long price) const
+    {
+        long long unit=price-1;
+        for(int layer=0;layer<layers && unit>=0;layer++)
+        {
+            uint64_t currWord=word(layer,unit>>6)&(~0ULL>>(63-(unit&63)));
+            if(currWord!=0)
+            {
+                unit=((unit>>6)<<6)|(63-__builtin_clzll(currWord));
+                for(int lower=layer-1;lower>=0;lower--)
+                {
+                    unit=(unit<<6)|(63-__builtin_clzll(word(lower,unit)));
+                }
+                return (int)unit;
+            }
+            unit=(unit>>6)-1;
+        }
+        return 0;
+    }
+};
+
+/*
+ Class to works as a handler for both buyPriority queue and sellPriority queue
+ buyPriority queue is implemented as a decreasing order set recreating the functionality of a maximum heap
+ sellPriority queue is implemented as a increasing order set recreating the functionality of a minimum heap
+ for performance reasons both buyPriority and sellPriority are implemented as set which internally are implemented as Binary Search Trees (BST)
+ BST have insert, delete, and find operations in O(logN)
+ Priority Queues also known as heaps have insert and delete from the top in O(1) but when deleting and finding elements from the middle or the back the worst case scenario is O(N) for that reason I didnt used this data structure
+ The sets store the price levels instead of the orders, the orders of each level are kept in a linked list inside the OrderArena, so inserting or deleting an order only touches the set when its level is created or gets empty
+ In the lazy deletion mode the levels that get empty are left in the set as tombstones, they are discarded when they reach the top of the set or revived if a new order arrives at their price, and the set is compacted when the ratio of empty levels goes over maxDeadRatio
+ The functions are templates on the side, so the proper set is chosen at compile time instead of comparing the orderType in every operation
+ */
+
+class QueueHandler
+{
+private:
+    /*
+     Fields
+     buyPriority decreasing order set recreating the functionality of a maximum heap for storing the buy price levels in the OrderBook with insert, delete, and find operations in O(logN)
+     sellPriority increasing order set recreating the functionality of a minimum heap for storing the sell price levels in the OrderBook with insert, delete, and find operations in O(logN)
+     levels: unordered_map of the price levels of each side indexed by price, indexed by side. The containers store pointers to these levels, which are stable while the level exists
+     ladders: aggregated quantity per price level of each side, indexed by side, kept updated on every insertion and deletion
+     orderCount: Number of orders resting in each side, indexed by side
+     deadLevels: Number of empty levels left in the set of each side by the lazy deletion mode, indexed by side
+     lazyDelete: true if the empty levels are left in the sets as tombstones instead of being deleted right away
+     maxDeadRatio, minCompactLevels: the set of a side is compacted when it has at least minCompactLevels levels and the empty ones go over this ratio
+     best: cached best level with orders of each side, indexed by side, nullptr if the side is empty. It is kept updated when levels are added and invalidated when the cached level gets empty
+     bestValid: true if the cached best level of the side can be used, otherwise it is recomputed on the next query
+     bookHash: XOR of the hashes of all the orders resting in the book (Zobrist hashing), every change of an order removes its old hash and adds the new one in O(1)
+     indexMode: how the price levels are indexed, see IndexMode
+     directIndex: true if the levels of the side are not kept in its set and the best level is found with its PriceLadder or its LevelBitmap, indexed by side. The cached best level is then always valid and when it gets empty the next one is the nearest non empty price, there are no tombstones
+     bitmaps: LevelBitmap of each side, only kept while the side is indexed directly
+     minLadderLevels, maxLadderGap: in the AUTO mode a side is indexed directly when it has at least minLadderLevels levels, and it goes back to its set at half of them. The next level is searched in the ladder if it is dense and has no more than maxLadderGap prices per level, so the scan stays short, and in the bitmap otherwise
+     arena: reference to the OrderArena where the orders are stored
+     stats: reference to the counters of the OrderBook, used to count the insertions and deletions in each set
+     */
+    set<Level*,Priority<Buy>,CountingAllocator<Level*,MemoryAccount::LEVEL_INDEX>> buyPriority;
+    set<Level*,Priority<Sell>,CountingAllocator<Level*,MemoryAccount::LEVEL_INDEX>> sellPriority;
+    LevelMap levels[2];
+    PriceLadder ladders[2];
+    long long orderCount[2]={0,0};
+    long long deadLevels[2]={0,0};
+    bool lazyDelete=false;
+    static constexpr double maxDeadRatio=0.5;
+    static const int minCompactLevels=64;
+    Level *best[2]={nullptr,nullptr};
+    bool bestValid[2]={true,true};
+    unsigned long long bookHash=0;
+    IndexMode indexMode=IndexMode::AUTO;
+    bool directIndex[2]={false,false};
+    LevelBitmap bitmaps[2];
+    static const int minLadderLevels=32;
+    static const int maxLadderGap=64;
+    OrderArena &arena;
+    Stats &stats;
+public:
+    /*
+     Constructor
+     @param ar: arena where the orders are stored
+     @param st: counters where the insertions and deletions will be recorded
+     */
+    QueueHandler(OrderArena &ar,Stats &st):arena(ar),stats(st){};
+    /*
+     Function to get the set of a side, the choice is done at compile time
+     */
+    template<class Side>
+    auto& queue()
+    {
+        if constexpr(Side::type==SideType::BUY)
+        {
+            return buyPriority;
+        }
+        else
+        {
+            return sellPriority;
+        }
+    }
+    /*
+     Function to get the PriceLadder of a side
+     */
+    template<class Side>
+    PriceLadder& ladder()
+    {
+        return ladders[Side::index];
+    }
+    /*
+     Function to get the price levels of a side
+     */
+    template<class Side>
+    LevelMap& levelMap()
+    {
+        return levels[Side::index];
+    }
+    /*
+     Function to get the price level at the top of the set of a side, it can be an empty level left by the lazy deletion mode, the set must not be empty. A side indexed directly returns its cached best level
+     */
+    template<class Side>
+    Level& topLevel()
+    {
+        if(directIndex[Side::index])
+        {
+            return *best[Side::index];
+        }
+        return **queue<Side>().begin();
+    }
+    /*
+     Function to delete the price level at the top of the set of a side, a side indexed directly moves its cached best level to the next one instead
+     */
+    template<class Side>
+    void popLevel()
+    {
+        if(directIndex[Side::index])
+        {
+            best[Side::index]=nextLevel<Side>(topLevel<Side>().price);
+            bestValid[Side::index]=true;
+            return;
+        }
+        queue<Side>().erase(queue<Side>().begin());
+    }
+    /*
+     Function to discard the empty levels at the top of the set of a side, so the top is always a level with orders
+     */
+    template<class Side>
+    void discardTombstones()
+    {
+        auto &currQueue=queue<Side>();
+        while(deadLevels[Side::index]>0 && !currQueue.empty() && topLevel<Side>().count==0)
+        {
+            int price=topLevel<Side>().price;
+            popLevel<Side>();
+            levelMap<Side>().erase(price);
+            deadLevels[Side::index]--;
+            stats.erases[Side::index]++;
+            stats.tombstonesDiscarded++;
+        }
+    }
+    /*
+     Function to get the price level with the highest priority of a side, the set must not be empty
+     */
+    template<class Side>
+    Level& bestLevel()
+    {
+        discardTombstones<Side>();
+        return topLevel<Side>();
+    }
+    /*
+     Function to get the cached best level with orders of a side in O(1), nullptr if the side is empty. The cache is only recomputed from the set after the cached level got empty
+     */
+    template<class Side>
+    const Level* cachedBest()
+    {
+        if(!bestValid[Side::index])
+        {
+            best[Side::index]=empty<Side>()?nullptr:&bestLevel<Side>();
+            bestValid[Side::index]=true;
+        }
+        return best[Side::index];
+    }
+    /*
+     Function to get the slot of the order with the highest priority of a side, the set must not be empty
+     */
+    template<class Side>
+    int top()
+    {
+        return bestLevel<Side>().head;
+    }
+    /*
+     Function to check if the set of a side is empty
+     */
+    template<class Side>
+    bool empty()
+    {
+        if(directIndex[Side::index])
+        {
+            return levelMap<Side>().empty();
+        }
+        discardTombstones<Side>();
+        return queue<Side>().empty();
+    }
+    /*
+     Function to enable or disable the lazy deletion mode, when it is disabled the empty levels left in the sets are removed
+     @param lazy: true to enable the lazy deletion mode
+     */
+    void setLazyDelete(bool lazy)
+    {
+        lazyDelete=lazy;
+        if(!lazy)
+        {
+            compact<Buy>();
+            compact<Sell>();
+        }
+    }
+    /*
+     Function to set how the price levels are indexed, the sides move to the new index at the next call to adapt
+     @param mode: IndexMode to use
+     */
+    void setIndexMode(IndexMode mode)
+    {
+        indexMode=mode;
+    }
+    /*
+     Function to check if the levels of a side are indexed directly instead of kept in its set
+     */
+    template<class Side>
+    bool isDirect() const
+    {
+        return directIndex[Side::index];
+    }
+    /*
+     Function to get the LevelBitmap of a side, it is only kept while the side is indexed directly
+     */
+    template<class Side>
+    const LevelBitmap& bitmap() const
+    {
+        return bitmaps[Side::index];
+    }
+    /*
+     Function to check if the next level of a side indexed directly is searched in its ladder instead of its bitmap
+     */
+    template<class Side>
+    bool scanLadder()
+    {
+        PriceLadder &sideLadder=ladder<Side>();
+        if(indexMode==IndexMode::BITMAP || !sideLadder.isDense())
+        {
+            return false;
+        }
+        return indexMode==IndexMode::LADDER || sideLadder.span()<=(long long)levelMap<Side>().size()*maxLadderGap;
+    }
+    /*
+     Function to get the next level with orders after a price in the priority order of a side indexed directly, found with its ladder or its bitmap
+     @param price: Integer value representing the price where the search starts
+     @return the level, nullptr if there is none
+     */
+    template<class Side>
+    Level* nextLevel(int price)
+    {
+        int nextPrice;
+        if(scanLadder<Side>())
+        {
+            nextPrice=Side::type==SideType::BUY?ladder<Side>().below(price):ladder<Side>().above(price);
+        }
+        else
+        {
+            nextPrice=Side::type==SideType::BUY?bitmaps[Side::index].below(price):bitmaps[Side::index].above(price);
+        }
+        return nextPrice==0?nullptr:&levelMap<Side>().find(nextPrice)->second;
+    }
+    /*
+     Function to get the best level with orders of a side indexed directly, found with its ladder or its bitmap
+     @return the level, nullptr if the side is empty
+     */
+    template<class Side>
+    Level* firstLevel()
+    {
+        int firstPrice;
+        if(scanLadder<Side>())
+        {
+            firstPrice=Side::type==SideType::BUY?ladder<Side>().highest():ladder<Side>().lowest();
+        }
+        else
+        {
+            firstPrice=Side::type==SideType::BUY?bitmaps[Side::index].highest():bitmaps[Side::index].lowest();
+        }
+        return firstPrice==0?nullptr:&levelMap<Side>().find(firstPrice)->second;
+    }
+    /*
+     Function to choose the index of the levels of a side from the shape of the book, it must be called between events, when the ladder and the levels agree. The levels are moved to the new index in bulk
+     */
+    template<class Side>
+    void adapt()
+    {
+        bool indexed=directIndex[Side::index];
+        bool wanted=indexMode!=IndexMode::NATIVE;
+        if(indexMode==IndexMode::AUTO)
+        {
+            long long liveLevels=(long long)levelMap<Side>().size()-deadLevels[Side::index];
+            wanted=liveLevels*(indexed?2:1)>=minLadderLevels;
+        }
+        if(wanted && !indexed)
+        {
+            indexDirect<Side>();
+        }
+        else if(!wanted && indexed)
+        {
+            indexWithSet<Side>();
+        }
+    }
+    /*
+     Function to stop keeping the levels of a side in its set and find them with its ladder or its bitmap, the tombstones are removed first and the bitmap is built from the levels
+     */
+    template<class Side>
+    void indexDirect()
+    {
+        compact<Side>();
+        queue<Side>()={};
+        for(auto &currLevel:levelMap<Side>())
+        {
+            bitmaps[Side::index].add(currLevel.first);
+        }
+        directIndex[Side::index]=true;
+        best[Side::index]=firstLevel<Side>();
+        bestValid[Side::index]=true;
+        stats.indexSwitches++;
+    }
+    /*
+     Function to insert again all the levels of a side in its set, used when the side gets too shallow to be indexed directly
+     */
+    template<class Side>
+    void indexWithSet()
+    {
+        auto &currQueue=queue<Side>();
+        for(auto &currLevel:levelMap<Side>())
+        {
+            currQueue.insert(&currLevel.second);
+        }
+        bitmaps[Side::index]=LevelBitmap();
+        directIndex[Side::index]=false;
+        stats.indexSwitches++;
+    }
+    /*
+     Function to add or remove the hash of an order to the hash of its level and of the book, XOR is its own inverse so the same call does both
+     @param level: price level of the order
+     @param slot: slot of the order in the arena
+     */
+    void toggleHash(Level &level,int slot)
+    {
+        unsigned long long hash=arena.getHash(slot);
+        level.hash^=hash;
+        bookHash^=hash;
+    }
+    /*
+     Function to get the hash of the orders resting in the book
+     */
+    unsigned long long getBookHash() const
+    {
+        return bookHash;
+    }
+    /*
+     Function to link an order at the back of the list of a price level
+     @param level: price level of the order
+     @param slot: slot of the order in the arena
+     */
+    void linkBack(Level &level,int slot)
+    {
+        arena.prev[slot]=level.tail;
+        arena.next[slot]=-1;
+        if(level.tail>=0)
+        {
+            arena.next[level.tail]=slot;
+        }
+        else
+        {
+            level.head=slot;
+        }
+        level.tail=slot;
+    }
+    /*
+     Function to unlink an order from the list of a price level
+     @param level: price level of the order
+     @param slot: slot of the order in the arena
+     */
+    void unlink(Level &level,int slot)
+    {
+        int prevSlot=arena.prev[slot];
+        int nextSlot=arena.next[slot];
+        if(prevSlot>=0)
+        {
+            arena.next[prevSlot]=nextSlot;
+        }
+        else
+        {
+            level.head=nextSlot;
+        }
+        if(nextSlot>=0)
+        {
+            arena.prev[nextSlot]=prevSlot;
+        }
+        else
+        {
+            level.tail=prevSlot;
+        }
+    }
+    /*
+     Function to insert an order at the back of its price level, the level is created and inserted in the set of the side if it does not exist
+     @param slot: slot of the order in the arena
+     */
+    template<class Side>
+    void addToQueue(int slot)
+    {
+        int price=arena.priceBid[slot];
+        auto res=levelMap<Side>().try_emplace(price);
+        Level &level=res.first->second;
+        if(res.second)
+        {
+            level.price=price;
+            if(directIndex[Side::index])
+            {
+                bitmaps[Side::index].add(price);
+            }
+            else
+            {
+                queue<Side>().insert(&level);
+            }
+            stats.inserts[Side::index]++;
+        }
+        else if(level.count==0)
+        {
+            deadLevels[Side::index]--;
+        }
+        linkBack(level,slot);
+        toggleHash(level,slot);
+        level.count++;
+        level.icebergs+=arena.isIceberg(slot);
+        level.quantity+=arena.quantity[slot];
+        ladder<Side>().add(price,arena.quantity[slot]);
+        if(bestValid[Side::index] && (best[Side::index]==nullptr || Side::better(price,best[Side::index]->price)))
+        {
+            best[Side::index]=&level;
+        }
+        orderCount[Side::index]++;
+        stats.peakDepth[Side::index]=max(stats.peakDepth[Side::index],orderCount[Side::index]);
+    }
+    /*
+     Function to delete element from both priority queues when the side is only known at runtime, deciding to call the proper function depending on the side of the order
+     @param slot: slot of the order in the arena
+     */
+    void deleteFromQueue(int slot)
+    {
+        if(arena.side[slot]==SideType::BUY)
+        {
+            Delete<Buy>(slot);
+        }
+        else
+        {
+            Delete<Sell>(slot);
+        }
+    }
+    /*
+     Function to delete an order from its price level, if the level gets empty it is deleted from the set of the side
+     @param slot: slot of the order in the arena
+     */
+    template<class Side>
+    void Delete(int slot)
+    {
+        auto litr=levelMap<Side>().find(arena.priceBid[slot]);
+        Level &level=litr->second;
+        detach<Side>(level,slot);
+        ladder<Side>().remove(level.price,arena.quantity[slot]);
+        if(level.count==0)
+        {
+            dropLevel<Side>(litr);
+            checkCompact<Side>();
+        }
+    }
+    /*
+     Function to delete a batch of orders of a side in one pass. The orders are unlinked first, then each level touched updates the ladder once and, if it got empty, is deleted from the set once, and the set is checked for compaction once at the end
+     @param slots: slots of the orders to delete
+     @return the levels touched, best first, with the quantity left in each one
+     */
+    template<class Side>
+    vector<pair<int,long long>> DeleteBatch(const vector<int> &slots)
+    {
+        unordered_map<int,long long> removed;
+        vector<int> touched;
+        for(int slot:slots)
+        {
+            int price=arena.priceBid[slot];
+            detach<Side>(levelMap<Side>().find(price)->second,slot);
+            auto res=removed.try_emplace(price,0);
+            if(res.second)
+            {
+                touched.push_back(price);
+            }
+            res.first->second+=arena.quantity[slot];
+        }
+        sort(touched.begin(),touched.end(),[](int price1,int price2){return Side::better(price1,price2);});
+        vector<pair<int,long long>> depth;
+        for(int price:touched)
+        {
+            ladder<Side>().remove(price,removed[price]);
+            auto litr=levelMap<Side>().find(price);
+            depth.push_back({price,litr->second.quantity});
+            if(litr->second.count==0)
+            {
+                dropLevel<Side>(litr);
+            }
+        }
+        checkCompact<Side>();
+        return depth;
+    }
+    /*
+     Function to unlink an order from its price level updating the counters of the level and of the side, the ladder and the set are not touched
+     @param level: price level of the order
+     @param slot: slot of the order in the arena
+     */
+    template<class Side>
+    void detach(Level &level,int slot)
+    {
+        unlink(level,slot);
+        toggleHash(level,slot);
+        level.count--;
+        level.icebergs-=arena.isIceberg(slot);
+        level.quantity-=arena.quantity[slot];
+        orderCount[Side::index]--;
+    }
+    /*
+     Function to drop a price level that got empty, in the lazy deletion mode it is left in the set as a tombstone, otherwise it is deleted from the set and from the map of levels. A side indexed directly deletes it from the map of levels and from its bitmap and moves its cached best level to the next one if it was the best
+     @param litr: iterator to the level in the map of levels of the side
+     */
+    template<class Side>
+    void dropLevel(LevelMap::iterator litr)
+    {
+        if(directIndex[Side::index])
+        {
+            bitmaps[Side::index].remove(litr->first);
+            if(best[Side::index]==&litr->second)
+            {
+                best[Side::index]=nextLevel<Side>(litr->first);
+            }
+            levelMap<Side>().erase(litr);
+            stats.erases[Side::index]++;
+            return;
+        }
+        if(best[Side::index]==&litr->second)
+        {
+            bestValid[Side::index]=false;
+        }
+        if(lazyDelete)
+        {
+            deadLevels[Side::index]++;
+            stats.tombstones++;
+        }
+        else
+        {
+            eraseLevel<Side>(litr->second);
+            levelMap<Side>().erase(litr);
+            stats.erases[Side::index]++;
+        }
+    }
+    /*
+     Function to compact the set of a side in the lazy deletion mode when the ratio of tombstones goes over maxDeadRatio
+     */
+    template<class Side>
+    void checkCompact()
+    {
+        size_t levelsInQueue=queue<Side>().size();
+        if(lazyDelete && levelsInQueue>=minCompactLevels && deadLevels[Side::index]>maxDeadRatio*levelsInQueue)
+        {
+            compact<Side>();
+        }
+    }
+    /*
+     Function to delete an empty price level from the set of its side
+     @param level: price level to delete
+     */
+    template<class Side>
+    void eraseLevel(Level &level)
+    {
+        queue<Side>().erase(&level);
+    }
+    /*
+     Function to remove all the empty levels from the set of a side
+     */
+    template<class Side>
+    void removeEmptyLevels()
+    {
+        auto &currQueue=queue<Side>();
+        for(auto itr=currQueue.begin();itr!=currQueue.end();)
+        {
+            if((*itr)->count==0)
+            {
+                itr=currQueue.erase(itr);
+            }
+            else
+            {
+                itr++;
+            }
+        }
+    }
+    /*
+     Function to compact the set of a side removing all the tombstones left by the lazy deletion mode, the empty levels are removed from the set before they are freed
+     */
+    template<class Side>
+    void compact()
+    {
+        if(deadLevels[Side::index]==0)
+        {
+            return;
+        }
+        removeEmptyLevels<Side>();
+        auto &sideLevels=levelMap<Side>();
+        for(auto itr=sideLevels.begin();itr!=sideLevels.end();)
+        {
+            if(itr->second.count==0)
+            {
+                itr=sideLevels.erase(itr);
+            }
+            else
+            {
+                itr++;
+            }
+        }
+        stats.erases[Side::index]+=deadLevels[Side::index];
+        deadLevels[Side::index]=0;
+        stats.compactions++;
+    }
+    /*
+     Function to delete the best price level of a side with all its orders in one step, used by the sweeps that consume whole levels. The orders are not unlinked one by one and the ladder is not updated, the caller must release the orders and update the ladder
+     */
+    template<class Side>
+    void dropBestLevel()
+    {
+        Level &level=bestLevel<Side>();
+        int price=level.price;
+        orderCount[Side::index]-=level.count;
+        bookHash^=level.hash;
+        bestValid[Side::index]=false;
+        popLevel<Side>();
+        if(directIndex[Side::index])
+        {
+            bitmaps[Side::index].remove(price);
+        }
+        levelMap<Side>().erase(price);
+        stats.erases[Side::index]++;
+    }
+    /*
+     Function to move an order to the back of its price level with a new quantity, used to refill ICEBERG orders. The order stays in the same level so the containers are not touched, and it keeps its turn since the turn tells the resting order from the aggressor while matching, the time priority inside the level is given by its place in the list
+     @param slot: slot of the order in the arena
+     @param newQuantity: Integer value representing the new quantity of the order
+     */
+    template<class Side>
+    void requeue(int slot,int newQuantity)
+    {
+        Level &level=levelMap<Side>().find(arena.priceBid[slot])->second;
+        if(level.tail!=slot)
+        {
+            unlink(level,slot);
+            linkBack(level,slot);
+        }
+        changeQuantity<Side>(slot,newQuantity);
+    }
+    /*
+     Function to change the quantity of an order keeping its place in the price level, only the aggregated quantities are updated
+     @param slot: slot of the order in the arena
+     @param newQuantity: Integer value representing the new quantity of the order
+     */
+    template<class Side>
+    void changeQuantity(int slot,int newQuantity)
+    {
+        Level &level=levelMap<Side>().find(arena.priceBid[slot])->second;
+        int oldQuantity=arena.quantity[slot];
+        toggleHash(level,slot);
+        level.quantity+=newQuantity-oldQuantity;
+        if(newQuantity<oldQuantity)
+        {
+            ladder<Side>().remove(level.price,oldQuantity-newQuantity);
+        }
+        else
+        {
+            ladder<Side>().add(level.price,newQuantity-oldQuantity);
+        }
+        arena.quantity[slot]=newQuantity;
+        toggleHash(level,slot);
+    }
+    friend class OrderBook;
+};
+
+/*
+ Comparator used to order the stop orders waiting off the book of each side, the template is instantiated once per side
+ Stops are compared by trigger price, the ones closer to trigger first: a buy stop triggers when the last trade price rises to its trigger so the lowest triggers go first, the opposite for sell stops. Stops with the same trigger are ordered by turn
+ @param stop1: pair of trigger price and turn at the lhs of the comparison
+ @param stop2: pair of trigger price and turn at the rhs of the comparison
+ */
+template<class Side>
+struct StopPriority
+{
+    bool operator()(const pair<int,int> &stop1,const pair<int,int> &stop2) const
+    {
+        if(stop1.first!=stop2.first)
+        {
+            return Side::Opposite::better(stop1.first,stop2.first);
+        }
+        return stop1.second<stop2.second;
+    }
+};
+
+/*
+ Class to keep the STOP and STOPLIMIT orders waiting for their trigger price off the book, one sorted map per side keyed by trigger price and turn
+ Since the stops of a side are sorted by how close they are to trigger, the stops crossed by a trade are always at the beginning of the map, so triggering costs O(triggered) instead of scanning all the stops
+ */
+class StopBook
+{
+private:
+    /*
+     Fields
+     buyStops: map of the buy stops, lowest trigger price first, to their slot in the arena
+     sellStops: map of the sell stops, highest trigger price first, to their slot in the arena
+     arena: reference to the OrderArena where the orders are stored
+     */
+    map<pair<int,int>,int,StopPriority<Buy>,CountingAllocator<pair<const pair<int,int>,int>,MemoryAccount::STOPS>> buyStops;
+    map<pair<int,int>,int,StopPriority<Sell>,CountingAllocator<pair<const pair<int,int>,int>,MemoryAccount::STOPS>> sellStops;
+    OrderArena &arena;
+public:
+    /*
+     Constructor
+     @param ar: arena where the orders are stored
+     */
+    StopBook(OrderArena &ar):arena(ar){};
+    /*
+     Function to get the map of stops of a side, the choice is done at compile time
+     */
+    template<class Side>
+    auto& stops()
+    {
+        if constexpr(Side::type==SideType::BUY)
+        {
+            return buyStops;
+        }
+        else
+        {
+            return sellStops;
+        }
+    }
+    /*
+     Function to add a stop order, its trigger price and turn must be already set in the arena
+     @param slot: slot of the order in the arena
+     */
+    template<class Side>
+    void add(int slot)
+    {
+        stops<Side>().emplace(make_pair(arena.getTriggerPrice(slot),arena.getTurn(slot)),slot);
+    }
+    /*
+     Function to remove a stop order that was canceled before being triggered
+     @param slot: slot of the order in the arena
+     */
+    void remove(int slot)
+    {
+        pair<int,int> key(arena.getTriggerPrice(slot),arena.getTurn(slot));
+        if(arena.getSide(slot)==SideType::BUY)
+        {
+            buyStops.erase(key);
+        }
+        else
+        {
+            sellStops.erase(key);
+        }
+    }
+    /*
+     Function to move the stops of a side crossed by the last trade price to the triggered vector, it stops at the first stop not crossed
+     @param lastPrice: Integer value representing the price of the last trade
+     @param triggered: vector where the slots of the triggered stops are appended
+     */
+    template<class Side>
+    void popTriggered(int lastPrice,vector<int> &triggered)
+    {
+        auto &sideStops=stops<Side>();
+        auto itr=sideStops.begin();
+        while(itr!=sideStops.end() && Side::crosses(lastPrice,itr->first.first))
+        {
+            triggered.push_back(itr->second);
+            arena.setTriggerPrice(itr->second,0);
+            itr=sideStops.erase(itr);
+        }
+    }
+};
+
+/*
+ Class to keep the expiry times of the GTT orders resting in the book, implemented as a hierarchical timing wheel
+ The wheel has wheelLevels levels of 64 buckets, the level k covers the expiries up to 64^(k+1) ticks ahead with buckets of 64^k ticks. An order is added to the lowest level that covers its expiry, and when the clock reaches the start of a bucket of a higher level its orders are cascaded to the lower levels. Each order is added and cascaded at most wheelLevels times, so expiring orders costs O(1) amortised per order and per tick
+ The buckets are intrusive lists linked through arrays indexed by the slot of the order, so an order that leaves the book is removed in O(1). A bitmap per level marks the non empty buckets, it allows the clock to jump over the ticks where no bucket has to be visited
+ */
+class TimingWheel
+{
+private:
+    /*
+     Fields
+     wheelLevels: number of levels of the wheel, it covers 64^wheelLevels ticks ahead, the orders further ahead are parked in the last bucket of the highest level and cascaded again until they are in range
+     buckets: first slot of each bucket, indexed by level and bucket, -1 if the bucket is empty
+     occupied: bitmap of the non empty buckets of each level
+     next, prev: links of the list of the bucket of each order, indexed by slot
+     bucketOf: bucket where each order is linked, indexed by slot, -1 if the order is not in the wheel
+     now: current tick of the clock
+     count: number of orders in the wheel
+     arena: reference to the OrderArena where the orders are stored
+     */
+    static const int wheelLevels=4;
+    int buckets[wheelLevels*64];
+    uint64_t occupied[wheelLevels]={0,0,0,0};
+    CountedVector<int,MemoryAccount::EXPIRIES> next;
+    CountedVector<int,MemoryAccount::EXPIRIES> prev;
+    CountedVector<int,MemoryAccount::EXPIRIES> bucketOf;
+    long long now=0;
+    long long count=0;
+    OrderArena &arena;
+    /*
+     Function to link an order in the bucket that covers its expiry time
+     @param slot: slot of the order in the arena
+     */
+    void link(int slot)
+    {
+        long long expiry=arena.getExpiryTime(slot);
+        long long delta=max(expiry-now,0LL);
+        int level=0;
+        while(level<wheelLevels-1 && delta>=(1LL<<(6*(level+1))))
+        {
+            level++;
+        }
+        if(delta>=(1LL<<(6*wheelLevels)))
+        {
+            expiry=now+(1LL<<(6*wheelLevels))-1;
+        }
+        int idx=(int)((expiry>>(6*level))&63);
+        int bucket=level*64+idx;
+        prev[slot]=-1;
+        next[slot]=buckets[bucket];
+        if(buckets[bucket]>=0)
+        {
+            prev[buckets[bucket]]=slot;
+        }
+        buckets[bucket]=slot;
+        bucketOf[slot]=bucket;
+        occupied[level]|=1ULL<<idx;
+    }
+    /*
+     Function to unlink an order from its bucket
+     @param slot: slot of the order in the arena
+     */
+    void unlink(int slot)
+    {
+        int bucket=bucketOf[slot];
+        if(prev[slot]>=0)
+        {
+            next[prev[slot]]=next[slot];
+        }
+        else
+        {
+            buckets[bucket]=next[slot];
+        }
+        if(next[slot]>=0)
+        {
+            prev[next[slot]]=prev[slot];
+        }
+        if(buckets[bucket]<0)
+        {
+            occupied[bucket/64]&=~(1ULL<<(bucket%64));
+        }
+        bucketOf[slot]=-1;
+    }
+    /*
+     Function to take all the orders out of a bucket
+     @param bucket: index of the bucket, level*64+idx
+     @param out: vector where the slots of the orders are appended
+     */
+    void drain(int bucket,vector<int> &out)
+    {
+        while(buckets[bucket]>=0)
+        {
+            int slot=buckets[bucket];
+            unlink(slot);
+            out.push_back(slot);
+        }
+    }
+public:
+    /*
+     Constructor
+     @param ar: arena where the orders are stored, the expiry time of the orders is read from it
+     */
+    TimingWheel(OrderArena &ar):arena(ar)
+    {
+        fill(begin(buckets),end(buckets),-1);
+    }
+    /*
+     Function to get the current tick of the clock
+     */
+    long long getNow() const
+    {
+        return now;
+    }
+    /*
+     Function to add an order to the wheel, its expiry time must be already set in the arena and be later than the current tick
+     @param slot: slot of the order in the arena
+     */
+    void add(int slot)
+    {
+        if(slot>=(int)bucketOf.size())
+        {
+            next.resize(slot+1,-1);
+            prev.resize(slot+1,-1);
+            bucketOf.resize(slot+1,-1);
+        }
+        link(slot);
+        count++;
+    }
+    /*
+     Function to remove an order that left the book before its expiry, it does nothing if the order is not in the wheel
+     @param slot: slot of the order in the arena
+     */
+    void remove(int slot)
+    {
+        if(slot<(int)bucketOf.size() && bucketOf[slot]>=0)
+        {
+            unlink(slot);
+            count--;
+        }
+    }
+    /*
+     Function to advance the clock up to a tick, collecting the orders that expire on the way. In every tick the buckets of the higher levels starting at that tick are cascaded before the bucket of the tick in the lowest level is expired
+     When the lowest levels are empty the clock jumps to the next tick where a bucket of the first non empty level starts
+     @param to: tick where the clock stops
+     @param expired: vector where the slots of the expired orders are appended, in the order they expire
+     */
+    void advance(long long to,vector<int> &expired)
+    {
+        vector<int> cascaded;
+        while(now<to)
+        {
+            if(count==0)
+            {
+                now=to;
+                break;
+            }
+            long long step=1;
+            for(int level=0;level<wheelLevels && occupied[level]==0;level++)
+            {
+                step<<=6;
+            }
+            now=min((now/step+1)*step,to);
+            for(int level=wheelLevels-1;level>0;level--)
+            {
+                if(now%(1LL<<(6*level))==0)
+                {
+                    cascaded.clear();
+                    drain(level*64+(int)((now>>(6*level))&63),cascaded);
+                    for(int slot:cascaded)
+                    {
+                        link(slot);
+                    }
+                }
+            }
+            int before=(int)expired.size();
+            drain((int)(now&63),expired);
+            count-=(int)expired.size()-before;
+        }
+    }
+};
+
+/*
+ Class to map the order IDs to the slots of the orders in the arena
+ The IDs made only of digits, which are usually increasing integers, are stored in a sliding window of slots indexed directly by the ID, base plus a ring of windowSize positions, so the lookup is a subtraction and an array index without hashing or comparing strings
+ When an ID beyond the window arrives the window slides forward and the live IDs left behind move to a fallback hash table, where the other IDs (not numeric, with leading zeros or older than the window) are kept. The live positions of the window are also marked in a bitmap, so a slide jumps over the empty positions 64 at a time and stops as soon as every live ID has moved, a window without live IDs is just reset
+ */
+class OrderIndex
+{
+private:
+    /*
+     Fields
+     windowSize: number of IDs covered by the window, a power of 2 so the position in the ring is a mask
+     base: lowest ID covered by the window, -1 until the first numeric ID is inserted
+     ring: slot of the order of each ID of the window at position ID&(windowSize-1), -1 if there is none
+     occupied: bitmap of the positions of ring with an order, the bit of a position p is the bit p&63 of the word p>>6
+     live: number of orders in the window
+     lowest: no order of the window has an ID lower than this one, the slides start from it
+     fallback: unordered_map from the IDs out of the window to the slots of their orders
+     */
+    static const long long windowSize=1<<20;
+    long long base=-1;
+    CountedVector<int,MemoryAccount::ORDER_WINDOW> ring;
+    CountedVector<uint64_t,MemoryAccount::ORDER_WINDOW> occupied;
+    long long live=0;
+    long long lowest=0;
+    CountedHashMap<string,int,MemoryAccount::ORDER_MAP> fallback;
+    /*
+     Function to get the numeric value of an ID, only the IDs written as a plain integer without leading zeros are numeric, so every numeric value has a single ID
+     @param orderID: ID of the order
+     @return value of the ID, -1 if it is not numeric
+     */
+    static long long numericID(const string &orderID)
+    {
+        if(orderID.empty() || orderID.size()>18 || (orderID[0]=='0' && orderID.size()>1))
+        {
+            return -1;
+        }
+        long long value=0;
+        for(char c:orderID)
+        {
+            if(c<'0' || c>'9')
+            {
+                return -1;
+            }
+            value=value*10+(c-'0');
+        }
+        return value;
+    }
+    /*
+     Function to check if a numeric ID is covered by the window
+     @param value: value of the ID
+     */
+    bool inWindow(long long value) const
+    {
+        return base>=0 && value>=base && value<base+windowSize;
+    }
+    /*
+     Function to mark a position of the window as used or free
+     @param value: value of the ID
+     @param used: true if the position gets an order
+     */
+    void mark(long long value,bool used)
+    {
+        long long position=value&(windowSize-1);
+        uint64_t bit=1ULL<<(position&63);
+        if(used)
+        {
+            occupied[position>>6]|=bit;
+        }
+        else
+        {
+            occupied[position>>6]&=~bit;
+        }
+        live+=used?1:-1;
+    }
+    /*
+     Function to slide the window forward so it covers an ID, the live IDs that are left behind move to the fallback hash table. The IDs are visited with the occupied bitmap until none is left in the window
+     @param value: value of the ID that must be covered
+     */
+    void slide(long long value)
+    {
+        long long newBase=value-windowSize+1;
+        long long end=min(newBase,base+windowSize);
+        long long id=max(base,lowest);
+        while(id<end && live>0)
+        {
+            uint64_t bits=occupied[(id&(windowSize-1))>>6]&(~0ULL<<(id&63));
+            if(bits==0)
+            {
+                id=(id|63)+1;
+                continue;
+            }
+            id=(id&~63LL)|__builtin_ctzll(bits);
+            if(id>=end)
+            {
+                break;
+            }
+            int &slot=ring[id&(windowSize-1)];
+            fallback.emplace(to_string(id),slot);
+            slot=-1;
+            mark(id,false);
+            id++;
+        }
+        base=newBase;
+        lowest=max(id,newBase);
+    }
+public:
+    /*
+     Function to find the slot of an order
+     @param orderID: ID of the order
+     @return slot of the order, -1 if there is no order with that ID
+     */
+    int find(const string &orderID) const
+    {
+        long long value=numericID(orderID);
+        if(inWindow(value))
+        {
+            return ring[value&(windowSize-1)];
+        }
+        auto fitr=fallback.find(orderID);
+        return fitr==fallback.end()?-1:fitr->second;
+    }
+    /*
+     Function to add an order, the ID must not be in the index
+     @param orderID: ID of the order
+     @param slot: slot of the order in the arena
+     */
+    void insert(const string &orderID,int slot)
+    {
+        long long value=numericID(orderID);
+        if(value>=0 && base<0)
+        {
+            ring.assign(windowSize,-1);
+            occupied.assign(windowSize/64,0);
+            base=value;
+        }
+        if(value>=base+windowSize)
+        {
+            slide(value);
+        }
+        if(inWindow(value))
+        {
+            ring[value&(windowSize-1)]=slot;
+            lowest=live==0?value:min(lowest,value);
+            mark(value,true);
+        }
+        else
+        {
+            fallback.emplace(orderID,slot);
+        }
+    }
+    /*
+     Function to remove an order
+     @param orderID: ID of the order
+     */
+    void erase(const string &orderID)
+    {
+        long long value=numericID(orderID);
+        if(inWindow(value))
+        {
+            int &slot=ring[value&(windowSize-1)];
+            if(slot>=0)
+            {
+                slot=-1;
+                mark(value,false);
+            }
+        }
+        else
+        {
+            fallback.erase(orderID);
+        }
+    }
+    /*
+     Function to prefetch the position of an ID in the window or the bucket of the ID in the fallback hash table
+     @param orderID: ID of the order
+     */
+    void prefetch(const string &orderID) const
+    {
+        long long value=numericID(orderID);
+        if(inWindow(value))
+        {
+            __builtin_prefetch(&ring[value&(windowSize-1)]);
+            return;
+        }
+        auto bitr=fallback.begin(fallback.bucket(orderID));
+        if(bitr!=fallback.end(fallback.bucket(orderID)))
+        {
+            __builtin_prefetch(&*bitr);
+        }
+    }
+};
+
+/*
+ Class to keep the live orders of each owner (session or client), so all of them can be canceled in one pass when the owner disconnects
+ Each owner has an intrusive list of its orders linked through arrays indexed by the slot of the order, so an order that leaves the book is removed from its list in O(1)
+ */
+class OwnerLists
+{
+private:
+    /*
+     Fields
+     ownerIndex: unordered_map from the name of each owner to its index
+     heads: first slot of the list of each owner, indexed by owner index, -1 if the owner has no live orders
+     next, prev: links of the list of the owner of each order, indexed by slot
+     ownerOf: index of the owner of each order, indexed by slot, -1 if the order has no owner
+     */
+    CountedHashMap<string,int,MemoryAccount::OWNERS> ownerIndex;
+    CountedVector<int,MemoryAccount::OWNERS> heads;
+    CountedVector<int,MemoryAccount::OWNERS> next;
+    CountedVector<int,MemoryAccount::OWNERS> prev;
+    CountedVector<int,MemoryAccount::OWNERS> ownerOf;
+public:
+    /*
+     Function to add an order to the list of its owner, the owner is registered the first time it is seen
+     @param slot: slot of the order in the arena
+     @param owner: name of the owner of the order
+     */
+    void add(int slot,const string &owner)
+    {
+        auto res=ownerIndex.try_emplace(owner,(int)heads.size());
+        if(res.second)
+        {
+            heads.push_back(-1);
+        }
+        if(slot>=(int)ownerOf.size())
+        {
+            next.resize(slot+1,-1);
+            prev.resize(slot+1,-1);
+            ownerOf.resize(slot+1,-1);
+        }
+        int idx=res.first->second;
+        prev[slot]=-1;
+        next[slot]=heads[idx];
+        if(heads[idx]>=0)
+        {
+            prev[heads[idx]]=slot;
+        }
+        heads[idx]=slot;
+        ownerOf[slot]=idx;
+    }
+    /*
+     Function to remove an order from the list of its owner, it does nothing if the order has no owner
+     @param slot: slot of the order in the arena
+     */
+    void remove(int slot)
+    {
+        if(slot>=(int)ownerOf.size() || ownerOf[slot]<0)
+        {
+            return;
+        }
+        if(prev[slot]>=0)
+        {
+            next[prev[slot]]=next[slot];
+        }
+        else
+        {
+            heads[ownerOf[slot]]=next[slot];
+        }
+        if(next[slot]>=0)
+        {
+            prev[next[slot]]=prev[slot];
+        }
+        ownerOf[slot]=-1;
+    }
+    /*
+     Function to take all the live orders of an owner, its list is left empty
+     @param owner: name of the owner
+     @return slots of the orders of the owner
+     */
+    vector<int> take(const string &owner)
+    {
+        vector<int> slots;
+        auto fitr=ownerIndex.find(owner);
+        if(fitr==ownerIndex.end())
+        {
+            return slots;
+        }
+        for(int slot=heads[fitr->second];slot>=0;slot=next[slot])
+        {
+            slots.push_back(slot);
+            ownerOf[slot]=-1;
+        }
+        heads[fitr->second]=-1;
+        return slots;
+    }
+};
+
+/*
+ Function to share an amount between the orders of a price level in proportion to the quantity each one has left, in one pass over the contiguous quantities of the level
+ Every order gets the floor of its share, and the units left by the rounding are given one per order in time priority, so the result is deterministic. Since every share is rounded down the units left are fewer than the orders with quantity left, so one pass is enough
+ @param quantity: quantities of the orders of the level in time priority
+ @param fill: quantity already allocated to each order, the pro-rata shares are added to it
+ @param n: number of orders of the level
+ @param amount: quantity to share
+ */
+void allocateProRata(const int *quantity,int *fill,int n,long long amount)
+{
+    long long total=0;
+    for(int i=0;i<n;i++)
+    {
+        total+=quantity[i]-fill[i];
+    }
+    if(total<=amount)
+    {
+        copy(quantity,quantity+n,fill);
+        return;
+    }
+    long long given=0;
+    for(int i=0;i<n;i++)
+    {
+        int share=(int)((long long)(quantity[i]-fill[i])*amount/total);
+        fill[i]+=share;
+        given+=share;
+    }
+    for(int i=0;i<n && given<amount;i++)
+    {
+        if(fill[i]<quantity[i])
+        {
+            fill[i]++;
+            given++;
+        }
+    }
+}
+
+/*
+ Class to compute trade analytics while the engine runs, it is updated at the fill point with O(1) work per fill so the TRADE messages dont need to be parsed again
+ It keeps the running volume and VWAP, the traded volume of each price, and OHLCV bars closed every barSize ticks of the engine clock or every barSize traded units. The closed bars are printed as a compact stream with the format BAR open high low close volume
+ */
+class TradeAnalytics
+{
+private:
+    /*
+     Fields
+     trades: Number of fills
+     volume: Total traded quantity
+     notional: Sum of price times quantity of all the fills, VWAP is notional/volume
+     levelVolume: unordered_map of the traded quantity at each price
+     barMode: how the bars are closed, NONE if there are no bars, TIME every barSize ticks or VOLUME every barSize traded units
+     barSize: size of the bars in ticks or in traded units
+     barIndex: index of the bar open in the TIME mode, the tick of the trade divided by barSize
+     open, high, low, close, barVolume: OHLCV of the bar open, barVolume is 0 if no bar is open
+     */
+    long long trades=0;
+    long long volume=0;
+    long long notional=0;
+    CountedHashMap<int,long long,MemoryAccount::ANALYTICS> levelVolume;
+    enum class BarMode {NONE, TIME, VOLUME} barMode=BarMode::NONE;
+    long long barSize=0;
+    long long barIndex=0;
+    int open=0;
+    int high=0;
+    int low=0;
+    int close=0;
+    long long barVolume=0;
+    /*
+     Function to print the bar open and start a new one
+     */
+    void closeBar()
+    {
+        if(barVolume>0)
+        {
+            cout<<"BAR "<<open<<" "<<high<<" "<<low<<" "<<close<<" "<<barVolume<<endl;
+        }
+        barVolume=0;
+    }
+public:
+    /*
+     Function to set how the bars are closed, the bar open is printed before changing the mode
+     @param mode: TIME to close the bars every size ticks, VOLUME to close them every size traded units, any other value disables the bars
+     @param size: size of the bars
+     */
+    void setBars(const string &mode,long long size)
+    {
+        closeBar();
+        barSize=size;
+        barMode=BarMode::NONE;
+        if(size>0 && mode=="TIME")
+        {
+            barMode=BarMode::TIME;
+        }
+        else if(size>0 && mode=="VOLUME")
+        {
+            barMode=BarMode::VOLUME;
+        }
+    }
+    /*
+     Function to record a fill
+     @param price: Integer value representing the price of the fill
+     @param qty: Integer value representing the quantity of the fill
+     @param now: tick of the engine clock
+     */
+    void onTrade(int price,int qty,long long now)
+    {
+        trades++;
+        volume+=qty;
+        notional+=(long long)price*qty;
+        levelVolume[price]+=qty;
+        if(barMode==BarMode::NONE)
+        {
+            return;
+        }
+        if(barMode==BarMode::TIME)
+        {
+            onTime(now);
+            barIndex=now/barSize;
+        }
+        if(barVolume==0)
+        {
+            open=high=low=price;
+        }
+        high=max(high,price);
+        low=min(low,price);
+        close=price;
+        barVolume+=qty;
+        if(barMode==BarMode::VOLUME && barVolume>=barSize)
+        {
+            closeBar();
+        }
+    }
+    /*
+     Function to close the bar open in the TIME mode when the engine clock leaves it
+     @param now: tick of the engine clock
+     */
+    void onTime(long long now)
+    {
+        if(barMode==BarMode::TIME && barVolume>0 && now/barSize!=barIndex)
+        {
+            closeBar();
+        }
+    }
+    /*
+     Function to print the analytics with the format ANALYTICS trades volume vwap, followed by the bar open if any and by the traded volume of each price in decreasing order with the format VOLUME price quantity
+     */
+    void print()
+    {
+        ostringstream vwap;
+        vwap<<fixed<<setprecision(4)<<(volume>0?(double)notional/volume:0.0);
+        cout<<"ANALYTICS "<<trades<<" "<<volume<<" "<<vwap.str()<<endl;
+        if(barVolume>0)
+        {
+            cout<<"OPEN_BAR "<<open<<" "<<high<<" "<<low<<" "<<close<<" "<<barVolume<<endl;
+        }
+        map<int,long long,greater<int>> temp(levelVolume.begin(),levelVolume.end());
+        for(auto &level:temp)
+        {
+            cout<<"VOLUME "<<level.first<<" "<<level.second<<endl;
+        }
+    }
+};
+
+/*
+ Struct with the state of the book published in shared memory: the number of events published and the best levels of each side, best first, indexed by side
+ */
+struct BookState
+{
+    static const int depth=10;
+    long long events;
+    int levels[2];
+    int prices[2][depth];
+    long long quantities[2][depth];
+};
+
+/*
+ Struct mapped in shared memory, the state is guarded by a seqlock: the writer makes the sequence odd while it writes the state and even again when it is done, a reader copies the state and retries if the sequence was odd or changed during the copy
+ */
+struct SharedBook
+{
+    atomic<unsigned long long> sequence;
+    BookState state;
+};
+
+/*
+ Class to publish the BBO and the best levels of the book into a POSIX shared memory region, so other processes can read consistent snapshots without a syscall and without ever blocking the matching thread
+ */
+class BookPublisher
+{
+private:
+    /*
+     Fields
+     book: shared memory region mapped by the writer, nullptr if publishing is disabled
+     */
+    SharedBook *book=nullptr;
+    /*
+     Function to map a shared memory region
+     @param name: name of the region, it must start with /
+     @param create: true to create the region for writing, false to open an existing one for reading
+     @return the region mapped, nullptr if it could not be mapped
+     */
+    static SharedBook* mapRegion(const string &name,bool create)
+    {
+        int fd=shm_open(name.c_str(),create?O_CREAT|O_RDWR:O_RDONLY,0644);
+        if(fd<0)
+        {
+            return nullptr;
+        }
+        if(create && ftruncate(fd,sizeof(SharedBook))!=0)
+        {
+            close(fd);
+            return nullptr;
+        }
+        void *addr=mmap(nullptr,sizeof(SharedBook),create?PROT_READ|PROT_WRITE:PROT_READ,MAP_SHARED,fd,0);
+        close(fd);
+        return addr==MAP_FAILED?nullptr:static_cast<SharedBook*>(addr);
+    }
+public:
+    BookPublisher()=default;
+    BookPublisher(const BookPublisher&)=delete;
+    BookPublisher& operator=(const BookPublisher&)=delete;
+    ~BookPublisher()
+    {
+        if(book)
+        {
+            munmap(book,sizeof(SharedBook));
+        }
+    }
+    /*
+     Function to create the shared memory region where the book is published
+     @param name: name of the region, it must start with /
+     @return true if the region was created
+     */
+    bool open(const string &name)
+    {
+        book=mapRegion(name,true);
+        if(book)
+        {
+            book->sequence.store(0,memory_order_relaxed);
+            book->state=BookState();
+        }
+        return book!=nullptr;
+    }
+    /*
+     Function to check if the book is published
+     */
+    bool isOpen() const
+    {
+        return book!=nullptr;
+    }
+    /*
+     Function to publish the best levels of both sides
+     @param depth: prices of the best levels of each side, best first, with their quantity, indexed by side
+     */
+    void publish(const vector<pair<int,long long>> (&depth)[2])
+    {
+        unsigned long long seq=book->sequence.load(memory_order_relaxed);
+        book->sequence.store(seq+1,memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        BookState &state=book->state;
+        state.events++;
+        for(int sd=0;sd<2;sd++)
+        {
+            state.levels[sd]=(int)min(depth[sd].size(),(size_t)BookState::depth);
+            for(int i=0;i<state.levels[sd];i++)
+            {
+                state.prices[sd][i]=depth[sd][i].first;
+                state.quantities[sd][i]=depth[sd][i].second;
+            }
+        }
+        book->sequence.store(seq+2,memory_order_release);
+    }
+    /*
+     Function to read a consistent snapshot of a book published by another process, it never blocks the writer and retries while the writer is in the middle of an update
+     @param name: name of the region, it must start with /
+     @param state: snapshot of the state read
+     @return true if the region could be opened
+     */
+    static bool read(const string &name,BookState &state)
+    {
+        SharedBook *shared=mapRegion(name,false);
+        if(!shared)
+        {
+            return false;
+        }
+        unsigned long long before,after;
+        do
+        {
+            before=shared->sequence.load(memory_order_acquire);
+            state=shared->state;
+            atomic_thread_fence(memory_order_acquire);
+            after=shared->sequence.load(memory_order_relaxed);
+        }
+        while((before&1) || before!=after);
+        munmap(shared,sizeof(SharedBook));
+        return true;
+    }
+};
+
+/*
+ Class to represent an OrderBook, handling the order book actions (methods) such as insert, delete, cancel, modify,and update(reminder) order. It also handles trades (matches) and prints the reminding orders in the order book as well as the trades. It assigns a turn to each order in both orderBooks, this value is used when printing the trades to know which order came first
+ The strings received as input are converted to a side once at the entry functions, from there the side logic is written once as templates on the side
+ */
+
+class OrderBook
+{
+private:
+    /*
+     Fields
+     orderMap: OrderIndex of all orders buy and sell orders, it maps the orderID to the slot of the order in the arena. Numeric IDs are found by direct indexing in a sliding window and the other IDs in a hash table, both with insert, delete, and find operations in O(1)
+     arena: OrderArena storing the fields of all the orders
+     turn: variable general to all the order book that assigns turns to all orders, buy and sell orders. This value is used when determing print order between buy and sell orders
+     stats: counters of the work done by the order book, printed with the STATS command
+     QH: object of class Queue Handler that works as described above
+     stops: STOP and STOPLIMIT orders waiting for their trigger price off the book
+     lastTradePrice: price of the last trade, 0 before the first trade, it is the price that triggers the stops
+     triggering: true while the triggered stops are being injected, so the Match calls done by the injected orders dont inject stops themselves
+     timers: expiry times of the GTT orders resting in the book, it also keeps the engine clock
+     owners: live orders of each owner, used by the MASSCANCEL command
+     policy: policy used to allocate the quantity of an incoming order between the orders of the level it trades with
+     splitPercent: percentage of the quantity filled in time priority by the SPLIT policy
+     analytics: running VWAP, OHLCV bars and traded volume per price, updated at every fill
+     publisher: shared memory region where the BBO and the best levels are published after every event, if enabled
+     snapshots: number of snapshot processes still writing their file
+     adaptInterval, sinceAdapt: the index of the price levels is reviewed every adaptInterval events, sinceAdapt counts the events since the last review
+     allocSlots, allocQuantity, allocFill: buffers with the slots, quantities and allocations of the orders of the level being allocated, kept to avoid allocating them on every trade
+     memoryBudget: maximum number of accounted live bytes above the fixed cost of the OrderIndex window, once they are exceeded the new orders that would rest are rejected, 0 if there is no budget
+     memoryRejected: number of orders rejected by the memory budget
+     */
+    OrderIndex orderMap;
+    OrderArena arena;
+    int turn=0;
+    Stats stats;
+    QueueHandler QH{arena,stats};
+    StopBook stops{arena};
+    int lastTradePrice=0;
+    bool triggering=false;
+    TimingWheel timers{arena};
+    OwnerLists owners;
+    AllocationPolicy policy=AllocationPolicy::FIFO;
+    int splitPercent=40;
+    TradeAnalytics analytics;
+    BookPublisher publisher;
+    int snapshots=0;
+    static const int adaptInterval=1024;
+    int sinceAdapt=0;
+    vector<int> allocSlots;
+    vector<int> allocQuantity;
+    vector<int> allocFill;
+    long long memoryBudget=0;
+    long long memoryRejected=0;
+    
+public:
+    /*
+     Function to insert element at OrderBook checking if all the parameters passed are valid, it converts the orderType to its side and calls the template of that side. The orders that can rest (GFD, ICEBERG, GTT, STOP and STOPLIMIT) are rejected when the memory budget is exceeded, IOC and MARKET orders are always accepted since they only free memory
+     @param orderType: Type of the order, can be BUY or SELL
+     @param executionType: Execution type of the order, can be GFD (Good for Day), IOC (Insert or Cancel), MARKET, ICEBERG, STOP, STOPLIMIT or GTT (Good Till Time)
+     @param priceBid: Integer value representing the price bid related to the order, it is ignored by MARKET orders and it is the trigger price of STOP and STOPLIMIT orders
+     @param quantity: Integer value representing the quantity of the order
+     @param orderID: ID of the order, can be any sequence of printable characters
+     @param extra: Integer value representing the quantity displayed by an ICEBERG order, the limit price of a STOPLIMIT order or the expiry tick of a GTT order, it is ignored by the other orders
+     @param owner: name of the owner (session or client) of the order, empty if the order has no owner
+     @return true if the order was accepted, false if it was invalid, rejected by the memory budget or had the ID of an order still in the book
+     */
+    bool InsertOrder(string orderType,string executionType,int priceBid,int quantity,string orderID,long long extra=0,const string &owner="")
+    {
+        if(orderID!="" && quantity>0 && executionType=="MARKET")
+        {
+            if(orderType=="BUY")
+            {
+                InsertOrderMarket<Buy>(orderID,quantity);
+                return true;
+            }
+            else if(orderType=="SELL")
+            {
+                InsertOrderMarket<Sell>(orderID,quantity);
+                return true;
+            }
+        }
+        else if(orderID!="" && priceBid>0 && quantity>0 && (executionType=="STOP"||(executionType=="STOPLIMIT"&&extra>0)))
+        {
+            if(!WithinBudget(orderID))
+            {
+                return false;
+            }
+            int limitPrice=executionType=="STOP"?0:(int)extra;
+            if(orderType=="BUY")
+            {
+                return InsertOrderStop<Buy>(executionType,priceBid,limitPrice,quantity,orderID,owner);
+            }
+            else if(orderType=="SELL")
+            {
+                return InsertOrderStop<Sell>(executionType,priceBid,limitPrice,quantity,orderID,owner);
+            }
+        }
+        else if(orderID!="" && priceBid>0 && quantity>0 && (executionType=="IOC"||executionType=="GFD"||(executionType=="ICEBERG"&&extra>0)||(executionType=="GTT"&&extra>timers.getNow())))
+        {
+            if(executionType!="IOC" && !WithinBudget(orderID))
+            {
+                return false;
+            }
+            if(orderType=="BUY")
+            {
+                return InsertOrder<Buy>(executionType,priceBid,quantity,orderID,extra,owner);
+            }
+            else if(orderType=="SELL")
+            {
+                return InsertOrder<Sell>(executionType,priceBid,quantity,orderID,extra,owner);
+            }
+        }
+        return false;
+    }
+    /*
+     Function to check if there is memory for a new resting order, when the accounted live bytes, without the fixed cost of the OrderIndex window, exceed the budget the order is rejected with the format REJECT orderID MEMORY
+     @param orderID: ID of the order
+     @return true if the order is accepted
+     */
+    bool WithinBudget(const string &orderID)
+    {
+        if(memoryBudget==0 || memoryUsage.variable()<=memoryBudget)
+        {
+            return true;
+        }
+        memoryRejected++;
+        cout<<"REJECT "<<orderID<<" MEMORY"<<endl;
+        return false;
+    }
+    /*
+     Function to insert element at OrderBook in the side given as template parameter, it distinguishes between GFD and IOC execution types since they have different behaviours and life spans. It creates the order in the arena and inserts its slot in the hash map, an order with the ID of an order still in the book is ignored
+     An ICEBERG order rests in the book as a GFD order displaying only its peak quantity, and a GTT order rests as a GFD order until the engine clock reaches its expiry tick
+     @param executionType: Execution type of the order, can be GFD (Good for Day), IOC (Insert or Cancel), ICEBERG or GTT (Good Till Time)
+     @param priceBid: Integer value representing the price bid related to the order
+     @param quantity: Integer value representing the quantity of the order
+     @param orderID: ID of the order, can be any sequence of printable characters
+     @param extra: Integer value representing the quantity displayed by an ICEBERG order or the expiry tick of a GTT order
+     @param owner: name of the owner of the order, empty if the order has no owner
+     @return false if the order was ignored
+     */
+    template<class Side>
+    bool InsertOrder(const string &executionType,int priceBid,int quantity,const string &orderID,long long extra,const string &owner)
+    {
+        stats.mapLookups++;
+        if(orderMap.find(orderID)>=0)
+        {
+            return false;
+        }
+        int slot=arena.createOrder(orderID,Side::type,executionType,priceBid,quantity,++turn);
+        orderMap.insert(orderID,slot);
+        if(owner!="")
+        {
+            owners.add(slot,owner);
+        }
+        if(executionType=="GFD")
+        {
+            InsertOrderGFD<Side>(slot);
+        }
+        else if(executionType=="IOC")
+        {
+            InsertOrderIOC<Side>(slot);
+        }
+        else if(executionType=="ICEBERG")
+        {
+            arena.makeIceberg(slot,(int)extra);
+            InsertOrderGFD<Side>(slot);
+        }
+        else if(executionType=="GTT")
+        {
+            arena.setExpiryTime(slot,extra);
+            timers.add(slot);
+            InsertOrderGFD<Side>(slot);
+        }
+        return true;
+    }
+    /*
+     Function to insert Good For Day order at corresponding buy or sell priority queue, the order remains there until traded. After inserting any order it checks the order book for a match (trade)
+     The book is never crossed before an insertion, so the match is skipped when the order can not cross the cached best level of the opposite side
+     @param slot: slot of the order in the arena
+     */
+    template<class Side>
+    void InsertOrderGFD(int slot)
+    {
+        QH.addToQueue<Side>(slot);
+        if(Marketable<Side>(arena.getPriceBid(slot)))
+        {
+            Match();
+        }
+    }
+    /*
+     Function to check if an order of a side at a price can trade against the best level of the opposite side, it reads the cached best level so it does not touch the containers
+     @param price: Integer value representing the price of the order
+     */
+    template<class Side>
+    bool Marketable(int price)
+    {
+        const Level *opposite=QH.cachedBest<typename Side::Opposite>();
+        return opposite!=nullptr && Side::crosses(price,opposite->price);
+    }
+    /*
+     Function to insert Immediate or Cancel order at corresponding buy or sell priority queue, the order requests to be traded (if possible) immediately, then its canceled. It gets removed from the corresponding priority queue and then from the hash table
+     The stops triggered by its trades are injected once it is canceled, so they never trade against it
+     @param slot: slot of the order in the arena
+     */
+    template<class Side>
+    void InsertOrderIOC(int slot)
+    {
+        int quantity=arena.getQuantity(slot);
+        bool wasTriggering=triggering;
+        triggering=true;
+        QH.addToQueue<Side>(slot);
+        if(slot==QH.top<Side>())
+        {
+            Match();
+        }
+        if(arena.isLive(slot))
+        {
+            if(arena.getQuantity(slot)==quantity)
+            {
+                stats.iocKilled++;
+            }
+            CancelOrder<Side>(slot);
+        }
+        triggering=wasTriggering;
+        TriggerStops();
+    }
+    /*
+     Function to insert a STOP or STOPLIMIT order, the order waits off the book in the StopBook until the last trade price reaches its trigger price. Then a STOP order is executed as a MARKET order and a STOPLIMIT order is inserted as a GFD order at its limit price
+     A stop whose trigger is already crossed by the last trade is triggered right away
+     @param executionType: Execution type of the order, can be STOP or STOPLIMIT
+     @param triggerPrice: Integer value representing the last trade price that triggers the order
+     @param limitPrice: Integer value representing the price of the STOPLIMIT order once triggered, 0 for STOP orders
+     @param quantity: Integer value representing the quantity of the order
+     @param orderID: ID of the order, can be any sequence of printable characters
+     @param owner: name of the owner of the order, empty if the order has no owner
+     @return false if the order was ignored since its ID is still in the book
+     */
+    template<class Side>
+    bool InsertOrderStop(const string &executionType,int triggerPrice,int limitPrice,int quantity,const string &orderID,const string &owner)
+    {
+        stats.mapLookups++;
+        if(orderMap.find(orderID)>=0)
+        {
+            return false;
+        }
+        int slot=arena.createOrder(orderID,Side::type,executionType,limitPrice,quantity,++turn);
+        orderMap.insert(orderID,slot);
+        if(owner!="")
+        {
+            owners.add(slot,owner);
+        }
+        arena.setTriggerPrice(slot,triggerPrice);
+        stops.add<Side>(slot);
+        TriggerStops();
+        return true;
+    }
+    /*
+     Function to inject the stops triggered by the last trade price as aggressors. The stops crossed of both sides are taken from the StopBook and injected in the order they arrived, the trades done by them can trigger more stops so it repeats until no stop is crossed
+     */
+    void TriggerStops()
+    {
+        if(triggering)
+        {
+            return;
+        }
+        triggering=true;
+        vector<int> triggered;
+        while(lastTradePrice>0)
+        {
+            triggered.clear();
+            stops.popTriggered<Buy>(lastTradePrice,triggered);
+            stops.popTriggered<Sell>(lastTradePrice,triggered);
+            if(triggered.empty())
+            {
+                break;
+            }
+            sort(triggered.begin(),triggered.end(),[this](int slot1,int slot2){return arena.getTurn(slot1)<arena.getTurn(slot2);});
+            for(int slot:triggered)
+            {
+                stats.stopsTriggered++;
+                if(arena.getSide(slot)==SideType::BUY)
+                {
+                    InjectStop<Buy>(slot);
+                }
+                else
+                {
+                    InjectStop<Sell>(slot);
+                }
+            }
+        }
+        triggering=false;
+    }
+    /*
+     Function to inject a triggered stop order. A STOP order leaves the hash map and the arena and is executed as a MARKET order, a STOPLIMIT order keeps its slot and gets a new turn as a GFD order
+     @param slot: slot of the order in the arena
+     */
+    template<class Side>
+    void InjectStop(int slot)
+    {
+        if(arena.getPriceBid(slot)==0)
+        {
+            string orderID=arena.getOrderID(slot);
+            int quantity=arena.getQuantity(slot);
+            orderMap.erase(orderID);
+            stats.mapLookups++;
+            ReleaseSlot(slot);
+            InsertOrderMarket<Side>(orderID,quantity);
+        }
+        else
+        {
+            arena.setTurn(slot,++turn);
+            InsertOrderGFD<Side>(slot);
+        }
+    }
+    /*
+     Function to execute a MARKET order against the opposite side, the order never enters the book and the quantity that can not be traded is canceled
+     The sweep walks the levels of the opposite side from the best one, when the remaining quantity covers a whole level all its orders are filled and the level is dropped in one step, without updating the containers order by order. The last level, partially consumed, and the levels with ICEBERG orders, which are refilled, are traded in time priority order by order, or with the allocation policy of the book if it is not FIFO
+     The ladder is updated once at the end of the sweep for all the levels consumed. It prints a TRADE message per order filled and a summary with the format MARKET orderID filledQuantity notional levels canceledQuantity
+     @param orderID: ID of the order, can be any sequence of printable characters
+     @param quantity: Integer value representing the quantity of the order
+     */
+    template<class Side>
+    void InsertOrderMarket(const string &orderID,int quantity)
+    {
+        using Opposite=typename Side::Opposite;
+        stats.mapLookups++;
+        if(orderMap.find(orderID)>=0)
+        {
+            return;
+        }
+        ++turn;
+        stats.marketOrders++;
+        int remaining=quantity;
+        long long notional=0;
+        int levels=0;
+        int lastPrice=0;
+        vector<pair<int,int>> consumed;
+        while(remaining>0 && !QH.empty<Opposite>())
+        {
+            Level &level=QH.bestLevel<Opposite>();
+            int price=level.price;
+            if(price!=lastPrice)
+            {
+                levels++;
+                lastPrice=price;
+            }
+            if(remaining>=level.quantity && level.icebergs==0)
+            {
+                for(int slot=level.head;slot>=0;)
+                {
+                    int nextSlot=arena.getNext(slot);
+                    int qty=arena.getQuantity(slot);
+                    PrintFill(slot,orderID,price,qty);
+                    RecordTrade(price,qty);
+                    remaining-=qty;
+                    stats.fullFills++;
+                    CountMarketFill(remaining);
+                    orderMap.erase(arena.getOrderID(slot));
+                    stats.mapLookups++;
+                    ReleaseSlot(slot);
+                    slot=nextSlot;
+                }
+                notional+=(long long)price*level.quantity;
+                consumed.push_back({price,(int)level.quantity});
+                QH.dropBestLevel<Opposite>();
+                stats.levelsSwept++;
+            }
+            else if(policy!=AllocationPolicy::FIFO)
+            {
+                AllocateLevel(level,remaining);
+                for(size_t i=0;i<allocSlots.size();i++)
+                {
+                    int slot=allocSlots[i];
+                    int fillQty=allocFill[i];
+                    if(fillQty==0)
+                    {
+                        continue;
+                    }
+                    PrintFill(slot,orderID,price,fillQty);
+                    RecordTrade(price,fillQty);
+                    remaining-=fillQty;
+                    notional+=(long long)price*fillQty;
+                    CountMarketFill(remaining);
+                    FillResting<Opposite>(slot,fillQty);
+                }
+            }
+            else
+            {
+                int slot=level.head;
+                int qty=arena.getQuantity(slot);
+                int fillQty=min(qty,remaining);
+                PrintFill(slot,orderID,price,fillQty);
+                RecordTrade(price,fillQty);
+                remaining-=fillQty;
+                notional+=(long long)price*fillQty;
+                CountMarketFill(remaining);
+                if(fillQty==qty)
+                {
+                    stats.fullFills++;
+                    OrderFilled<Opposite>(slot);
+                }
+                else
+                {
+                    stats.partialFills++;
+                    UpdateOrder<Opposite>(slot,qty-fillQty);
+                }
+            }
+        }
+        QH.ladder<Opposite>().removeLevels(consumed);
+        cout<<"MARKET "<<orderID<<" "<<quantity-remaining<<" "<<notional<<" "<<levels<<" "<<remaining<<endl;
+        TriggerStops();
+    }
+    /*
+     Function to modify element at OrderBook checking if all the parameters passed are valid. It searches the order in the hash map in O(1) and proceed to modifying the order if it is found, converting the orderType to its side. Stops waiting for their trigger can not be modified
+     @param orderID: ID of the order, can be any sequence of printable characters
+     @param orderType: Type of the order, can be BUY or SELL
+     @param priceBid: Integer value representing the price bid related to the order
+     @param quantity: Integer value representing the quantity of the order
+     @return true if the order was modified
+     */
+    bool ModifyOrder(string orderID,string orderType,int priceBid,int quantity)
+    {
+        int slot=orderMap.find(orderID);
+        stats.mapLookups++;
+        if(slot>=0 && !arena.isStop(slot) && priceBid>0 && quantity>0)
+        {
+            if(orderType=="BUY")
+            {
+                ModifyOrder<Buy>(slot,priceBid,quantity);
+                return true;
+            }
+            else if(orderType=="SELL")
+            {
+                ModifyOrder<Sell>(slot,priceBid,quantity);
+                return true;
+            }
+        }
+        return false;
+    }
+    /*
+     Function to modify an order moving it to the side given as template parameter. It deletes the order from the priority queue since the turn based priority will be lost, then modifies the parameters of the order , and finally inserts the new order into the corresponging queue
+     A decrease of the quantity keeping the side and the price is applied in place instead, the order keeps its turn and its place in the level and it can not cross so there is no need to match. ICEBERG orders are always requeued since their quantity is split
+     @param slot: slot of the order in the arena
+     @param priceBid: Integer value representing the price bid related to the order
+     @param quantity: Integer value representing the quantity of the order
+     */
+    template<class Side>
+    void ModifyOrder(int slot,int priceBid,int quantity)
+    {
+        if(arena.getSide(slot)==Side::type && arena.getPriceBid(slot)==priceBid && quantity<arena.getQuantity(slot) && !arena.isIceberg(slot))
+        {
+            stats.modifiesInPlace++;
+            QH.changeQuantity<Side>(slot,quantity);
+            return;
+        }
+        QH.deleteFromQueue(slot);
+        arena.modifyOrder(slot,Side::type,priceBid,quantity,++turn);
+        QH.addToQueue<Side>(slot);
+        if(Marketable<Side>(priceBid))
+        {
+            Match();
+        }
+    }
+    /*
+     Function to update an orders quantity in the order book. It is called when an order that was traded has a reminder quantity, this order needs to be updated with the new quantity, but wont loose the turn priority, and the other parameters dont get modified. The order keeps its place in its price level so the containers are not touched
+     @param slot: slot of the order in the arena
+     @param newQuantity: Integer value representing the quantity of the order
+     */
+    template<class Side>
+    void UpdateOrder(int slot,int newQuantity)
+     {
+        stats.updatesInPlace++;
+        QH.changeQuantity<Side>(slot,newQuantity);
+     }
+    /*
+     Function to cancel an order in the order book and priority queue. It searches the order in the hash map in O(1) and proceed to cancel the order if it is found deleting it from the priority queue, or from the StopBook if it is a stop waiting for its trigger, erasing it from the hash table and releasing its slot
+     @param orderID: ID of the order, can be any sequence of printable characters
+     @return true if the order was found and canceled
+     */
+    bool CancelOrder(string orderID)
+    {
+        int slot=orderMap.find(orderID);
+        stats.mapLookups++;
+        if(slot>=0)
+        {
+            if(arena.isStop(slot))
+            {
+                stops.remove(slot);
+            }
+            else
+            {
+                QH.deleteFromQueue(slot);
+            }
+            orderMap.erase(orderID);
+            ReleaseSlot(slot);
+            return true;
+        }
+        return false;
+    }
+    /*
+     Function to cancel an order whose side is known at compile time, it is used by Match to remove the traded orders
+     @param slot: slot of the order in the arena
+     */
+    template<class Side>
+    void CancelOrder(int slot)
+    {
+        QH.Delete<Side>(slot);
+        orderMap.erase(arena.getOrderID(slot));
+        stats.mapLookups++;
+        ReleaseSlot(slot);
+    }
+    /*
+     Function to release the slot of an order that left the book, it is removed from the timing wheel and from the list of its owner before the slot can be reused
+     @param slot: slot of the order in the arena
+     */
+    void ReleaseSlot(int slot)
+    {
+        if(arena.hasExpiry(slot))
+        {
+            timers.remove(slot);
+        }
+        owners.remove(slot);
+        arena.releaseOrder(slot);
+    }
+    /*
+     Function to cancel all the live orders of an owner in one pass, including its stops waiting for their trigger. The orders resting in the book are deleted in a batch per side, so each level touched is updated once, and a DEPTH message with the quantity left is printed once per level touched
+     It prints a summary with the format MASSCANCEL owner canceledOrders
+     @param owner: name of the owner
+     */
+    void MassCancel(const string &owner)
+    {
+        vector<int> slots=owners.take(owner);
+        vector<int> buySlots,sellSlots;
+        for(int slot:slots)
+        {
+            if(arena.isStop(slot))
+            {
+                stops.remove(slot);
+            }
+            else if(arena.getSide(slot)==SideType::BUY)
+            {
+                buySlots.push_back(slot);
+            }
+            else
+            {
+                sellSlots.push_back(slot);
+            }
+        }
+        PrintDepth("SELL",QH.DeleteBatch<Sell>(sellSlots));
+        PrintDepth("BUY",QH.DeleteBatch<Buy>(buySlots));
+        for(int slot:slots)
+        {
+            orderMap.erase(arena.getOrderID(slot));
+            stats.mapLookups++;
+            ReleaseSlot(slot);
+        }
+        stats.massCanceled+=slots.size();
+        cout<<"MASSCANCEL "<<owner<<" "<<slots.size()<<endl;
+    }
+    /*
+     Function to print a DEPTH message per level touched with the format DEPTH side price quantityLeft
+     @param side: name of the side of the levels
+     @param depth: prices of the levels touched with their quantity left
+     */
+    void PrintDepth(const string &side,const vector<pair<int,long long>> &depth)
+    {
+        for(auto &level:depth)
+        {
+            cout<<"DEPTH "<<side<<" "<<level.first<<" "<<level.second<<endl;
+        }
+    }
+    /*
+     Function to set the allocation policy of the book
+     @param name: name of the policy, can be FIFO, PRORATA, TOPPRORATA or SPLIT
+     @param percent: percentage of the quantity filled in time priority by the SPLIT policy, -1 to keep the current one
+     */
+    void SetAllocationPolicy(const string &name,int percent)
+    {
+        if(name=="FIFO")
+        {
+            policy=AllocationPolicy::FIFO;
+        }
+        else if(name=="PRORATA")
+        {
+            policy=AllocationPolicy::PRORATA;
+        }
+        else if(name=="TOPPRORATA")
+        {
+            policy=AllocationPolicy::TOPPRORATA;
+        }
+        else if(name=="SPLIT" && percent>=-1 && percent<=100)
+        {
+            policy=AllocationPolicy::SPLIT;
+            if(percent>=0)
+            {
+                splitPercent=percent;
+            }
+        }
+    }
+    /*
+     Function to allocate an amount between the orders of a price level with the policy of the book. The level is copied once into the allocation buffers in time priority, the part taken in time priority is filled first and the rest is shared with allocateProRata
+     @param level: price level traded
+     @param amount: quantity to allocate, the allocation of each order is left in allocFill
+     */
+    void AllocateLevel(const Level &level,long long amount)
+    {
+        allocSlots.clear();
+        allocQuantity.clear();
+        for(int slot=level.head;slot>=0;slot=arena.getNext(slot))
+        {
+            allocSlots.push_back(slot);
+            allocQuantity.push_back(arena.getQuantity(slot));
+        }
+        int n=(int)allocSlots.size();
+        allocFill.assign(n,0);
+        long long inTime=0;
+        if(policy==AllocationPolicy::TOPPRORATA)
+        {
+            inTime=min(amount,(long long)allocQuantity[0]);
+        }
+        else if(policy==AllocationPolicy::SPLIT)
+        {
+            inTime=amount*splitPercent/100;
+        }
+        amount-=inTime;
+        for(int i=0;i<n && inTime>0;i++)
+        {
+            allocFill[i]=(int)min(inTime,(long long)allocQuantity[i]);
+            inTime-=allocFill[i];
+        }
+        allocateProRata(allocQuantity.data(),allocFill.data(),n,amount+inTime);
+    }
+    /*
+     Function to apply a fill to a resting order, the order is updated in place if it has quantity left, otherwise it is handled as filled
+     @param slot: slot of the resting order
+     @param fillQty: Integer value representing the traded quantity
+     */
+    template<class Side>
+    void FillResting(int slot,int fillQty)
+    {
+        int qty=arena.getQuantity(slot);
+        if(fillQty==qty)
+        {
+            stats.fullFills++;
+            OrderFilled<Side>(slot);
+        }
+        else
+        {
+            stats.partialFills++;
+            UpdateOrder<Side>(slot,qty-fillQty);
+        }
+    }
+    /*
+     Function to trade an incoming order against the best level of the opposite side with the allocation policy of the book, the whole level is allocated in one pass instead of matching order by order
+     @param aggressorSlot: slot of the incoming order, it is the top order of its side
+     */
+    template<class Resting>
+    void MatchLevel(int aggressorSlot)
+    {
+        using Aggressor=typename Resting::Opposite;
+        Level &level=QH.bestLevel<Resting>();
+        int price=level.price;
+        int aggressorQty=arena.getQuantity(aggressorSlot);
+        AllocateLevel(level,aggressorQty);
+        int traded=0;
+        for(size_t i=0;i<allocSlots.size();i++)
+        {
+            int slot=allocSlots[i];
+            int fillQty=allocFill[i];
+            if(fillQty==0)
+            {
+                continue;
+            }
+            if constexpr(Resting::type==SideType::BUY)
+            {
+                PrintMatch(slot,aggressorSlot,fillQty);
+            }
+            else
+            {
+                PrintMatch(aggressorSlot,slot,fillQty);
+            }
+            RecordTrade(price,fillQty);
+            traded+=fillQty;
+            FillResting<Resting>(slot,fillQty);
+        }
+        FillResting<Aggressor>(aggressorSlot,traded);
+    }
+    /*
+     Function to handle a resting order whose displayed quantity was completely traded. An ICEBERG order with hidden quantity left is refilled, otherwise the order is canceled
+     @param slot: slot of the order in the arena
+     */
+    template<class Side>
+    void OrderFilled(int slot)
+    {
+        if(arena.getHiddenQuantity(slot)>0)
+        {
+            Replenish<Side>(slot);
+        }
+        else
+        {
+            CancelOrder<Side>(slot);
+        }
+    }
+    /*
+     Function to refill an ICEBERG order with the next peak of its hidden quantity. The order loses its time priority and goes to the back of its price level, but it keeps its turn, its slot and its level so the aggressor of the trades is still known and the containers and the hash map are not touched
+     @param slot: slot of the order in the arena
+     */
+    template<class Side>
+    void Replenish(int slot)
+    {
+        stats.icebergRefills++;
+        int displayed=arena.takeHidden(slot);
+        QH.requeue<Side>(slot,displayed);
+    }
+    /*
+     Function to advance the engine clock, the GTT orders whose expiry tick is reached are canceled through the normal cancel path and reported with an EXPIRED message, in order of expiry and then of turn. The clock never goes back
+     @param now: tick where the engine clock is moved
+     */
+    void AdvanceTime(long long now)
+    {
+        vector<int> expired;
+        timers.advance(now,expired);
+        analytics.onTime(timers.getNow());
+        sort(expired.begin(),expired.end(),[this](int slot1,int slot2){return make_pair(arena.getExpiryTime(slot1),arena.getTurn(slot1))<make_pair(arena.getExpiryTime(slot2),arena.getTurn(slot2));});
+        for(int slot:expired)
+        {
+            stats.ordersExpired++;
+            cout<<"EXPIRED "<<arena.getOrderID(slot)<<" "<<arena.getQuantity(slot)+arena.getHiddenQuantity(slot)<<endl;
+            if(arena.getSide(slot)==SideType::BUY)
+            {
+                CancelOrder<Buy>(slot);
+            }
+            else
+            {
+                CancelOrder<Sell>(slot);
+            }
+        }
+    }
+    /*
+     Function to check for matches in the orderbook, it compares than neither priority queue is empty and then compares the top most element of each queue (buy and sell) everytime the buy price is greater than or equal to the sell price, it crosses a match and does a trade. It calculates the minimum quantity between the buy quantity and sell quantity since that will be the traded quantity, and prints the TRADE message. Then it calculates the reminder quantity as the difference between buy and sell traded orders, it updates the order with the greater quantity with the reminder, and deletes the other order. If both orders have the same quantity both get deleted. It keeps doing this process until no trades can be made, this function gets called everytime an order is inserted
+     The trade price, recorded as the last trade price, is the price of the order that came first. After the pass the stops triggered by the last trade price are injected
+     If the allocation policy of the book is not FIFO the order that came last is the incoming order, and it trades with the whole best level of the other side at once using MatchLevel
+     */
+    void Match()
+    {
+        bool keepMatching=true;
+        stats.matchCalls++;
+        tracer.record(TraceType::MATCH_BEGIN);
+        while(keepMatching)
+        {
+            stats.matchIterations++;
+            if((!QH.empty<Buy>()&&!QH.empty<Sell>())&&Buy::crosses(QH.bestLevel<Buy>().price,QH.bestLevel<Sell>().price))
+            {
+                int buySlot=QH.top<Buy>();
+                int sellSlot=QH.top<Sell>();
+                if(policy!=AllocationPolicy::FIFO)
+                {
+                    if(arena.getTurn(buySlot)>arena.getTurn(sellSlot))
+                    {
+                        MatchLevel<Sell>(buySlot);
+                    }
+                    else
+                    {
+                        MatchLevel<Buy>(sellSlot);
+                    }
+                    continue;
+                }
+                int buyQty=arena.getQuantity(buySlot);
+                int sellQty=arena.getQuantity(sellSlot);
+                int minQty=min(buyQty,sellQty);
+                PrintMatch(buySlot,sellSlot,minQty);
+                RecordTrade(arena.getTurn(buySlot)<arena.getTurn(sellSlot)?arena.getPriceBid(buySlot):arena.getPriceBid(sellSlot),minQty);
+                if(buyQty!=sellQty)
+                {
+                    stats.partialFills++;
+                    stats.fullFills++;
+                    int nwqty=0;
+                    if(buyQty>sellQty)
+                    {
+                        nwqty=buyQty-sellQty;
+                        UpdateOrder<Buy>(buySlot,nwqty);
+                        OrderFilled<Sell>(sellSlot);
+                    }
+                    else
+                    {
+                        nwqty=sellQty-buyQty;
+                        UpdateOrder<Sell>(sellSlot,nwqty);
+                        OrderFilled<Buy>(buySlot);
+                    }
+                }
+                else
+                {
+                    stats.fullFills+=2;
+                    OrderFilled<Buy>(buySlot);
+                    OrderFilled<Sell>(sellSlot);
+                }
+            }
+            else
+            {
+                keepMatching=false;
+            }
+        }
+        tracer.record(TraceType::MATCH_END);
+        TriggerStops();
+    }
+    /*
+     Function to record a fill at the fill point, it keeps the last trade price used to trigger the stops and updates the analytics
+     @param price: Integer value representing the price of the trade
+     @param qty: Integer value representing the traded quantity
+     */
+    void RecordTrade(int price,int qty)
+    {
+        lastTradePrice=price;
+        analytics.onTrade(price,qty,timers.getNow());
+        tracer.record(TraceType::FILL,qty);
+    }
+    /*
+     Function to set how the OHLCV bars of the analytics are closed
+     @param mode: TIME or VOLUME, any other value disables the bars
+     @param size: size of the bars in ticks or in traded units
+     */
+    void SetBars(const string &mode,long long size)
+    {
+        analytics.setBars(mode,size);
+    }
+    /*
+     Function to print the trade analytics
+     */
+    void PrintAnalytics()
+    {
+        analytics.print();
+    }
+    /*
+     Function to print the output of a trade. It is called everytime a trade happens quantity, It assigns the printing order depending on the turn and outputs the TRADE message
+     @param buySlot: slot of the buy order traded
+     @param sellSlot: slot of the sell order traded
+     @param minQty: Minimum quantity between the buy quantity and sell quantity since that is the traded quantity
+     */
+    void PrintMatch(int buySlot,int sellSlot,int minQty)
+    {
+        if(arena.getTurn(buySlot)<arena.getTurn(sellSlot))
+        {
+            cout<<"TRADE " + arena.getOrderID(buySlot) + " "<<arena.getPriceBid(buySlot)<<" "<<minQty<<" " + arena.getOrderID(sellSlot) + " "<<arena.getPriceBid(sellSlot)<<" "<<minQty<<endl;
+        }
+        else
+        {
+            cout<<"TRADE " + arena.getOrderID(sellSlot) + " "<<arena.getPriceBid(sellSlot)<<" "<< minQty<<" " + arena.getOrderID(buySlot) + " "<<arena.getPriceBid(buySlot)<<" "<< minQty<<endl;
+        }
+    }
+    /*
+     Function to enable or disable the lazy deletion of empty price levels
+     @param lazy: true to enable the lazy deletion mode
+     */
+    void SetLazyDelete(bool lazy)
+    {
+        QH.setLazyDelete(lazy);
+    }
+    /*
+     Function to set how the price levels are indexed
+     @param name: name of the mode, can be auto, native, ladder or bitmap
+     @return false if the name is not valid
+     */
+    bool SetIndexMode(const string &name)
+    {
+        if(name=="auto")
+        {
+            QH.setIndexMode(IndexMode::AUTO);
+        }
+        else if(name=="native")
+        {
+            QH.setIndexMode(IndexMode::NATIVE);
+        }
+        else if(name=="ladder")
+        {
+            QH.setIndexMode(IndexMode::LADDER);
+        }
+        else if(name=="bitmap")
+        {
+            QH.setIndexMode(IndexMode::BITMAP);
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+    /*
+     Function to review the index of the price levels of both sides from the shape of the book every adaptInterval events, it is called between events so the levels can be moved safely
+     */
+    void Adapt()
+    {
+        if(++sinceAdapt<adaptInterval)
+        {
+            return;
+        }
+        sinceAdapt=0;
+        QH.adapt<Buy>();
+        QH.adapt<Sell>();
+    }
+    /*
+     Function to count the fill of a MARKET order, it is a full fill if no quantity remains
+     @param remaining: Integer value representing the quantity of the MARKET order still to be traded
+     */
+    void CountMarketFill(int remaining)
+    {
+        if(remaining==0)
+        {
+            stats.fullFills++;
+        }
+        else
+        {
+            stats.partialFills++;
+        }
+    }
+    /*
+     Function to print the output of a trade of a MARKET order against a resting order, the resting order is always printed first since it came first
+     @param slot: slot of the resting order traded
+     @param orderID: ID of the MARKET order
+     @param price: Integer value representing the price of the level traded
+     @param qty: Integer value representing the traded quantity
+     */
+    void PrintFill(int slot,const string &orderID,int price,int qty)
+    {
+        cout<<"TRADE " + arena.getOrderID(slot) + " "<<price<<" "<<qty<<" " + orderID + " "<<price<<" "<<qty<<endl;
+    }
+    /*
+     Function to print the counters of the work done by the OrderBook
+     */
+    void PrintStats()
+    {
+        stats.PrintStats();
+    }
+    /*
+     Function to print the memory report, one line per MemoryAccount with the format name liveBytes peakBytes allocations followed by the total, the accounted bytes per live order without the fixed cost of the OrderIndex window, the free slots of the arena over its slots, the bytes in use and free in the heap of the C library when it can be queried, and the budget with the number of orders it rejected
+     The free slots are the fragmentation of the arena and the free bytes of the heap are the memory released by the containers that the process still holds
+     */
+    void PrintMemory()
+    {
+        cout<<"MEMORY: "<<endl;
+        memoryUsage.print();
+        long long orders=arena.slots()-arena.freeCount();
+        cout<<"ORDERS "<<orders<<endl;
+        cout<<"BYTES_PER_ORDER "<<(orders>0?memoryUsage.variable()/orders:0)<<endl;
+        cout<<"FREE_SLOTS "<<arena.freeCount()<<" "<<arena.slots()<<endl;
+#if defined(__GLIBC__) && (__GLIBC__>2 || (__GLIBC__==2 && __GLIBC_MINOR__>=33))
+        struct mallinfo2 heap=mallinfo2();
+        cout<<"HEAP "<<heap.uordblks+heap.hblkhd<<" "<<heap.fordblks<<endl;
+#endif
+        cout<<"BUDGET "<<memoryBudget<<" "<<memoryRejected<<endl;
+    }
+    /*
+     Function to set the memory budget
+     @param budget: maximum number of accounted live bytes above the fixed cost of the OrderIndex window, 0 to disable the budget
+     */
+    void SetMemoryBudget(long long budget)
+    {
+        memoryBudget=budget;
+    }
+    /*
+     Function to print the best bid and ask with the format BBO bidPrice bidQuantity askPrice askQuantity, a side without orders is printed as 0 0. It is answered from the cached best levels without walking the book
+     */
+    void PrintBBO()
+    {
+        const Level *bid=QH.cachedBest<Buy>();
+        const Level *ask=QH.cachedBest<Sell>();
+        cout<<"BBO "<<(bid?bid->price:0)<<" "<<(bid?bid->quantity:0)<<" "<<(ask?ask->price:0)<<" "<<(ask?ask->quantity:0)<<endl;
+    }
+    /*
+     Function to print the spread between the best ask and the best bid with the format SPREAD spread, or SPREAD NA if a side has no orders
+     */
+    void PrintSpread()
+    {
+        const Level *bid=QH.cachedBest<Buy>();
+        const Level *ask=QH.cachedBest<Sell>();
+        if(bid && ask)
+        {
+            cout<<"SPREAD "<<ask->price-bid->price<<endl;
+        }
+        else
+        {
+            cout<<"SPREAD NA"<<endl;
+        }
+    }
+    /*
+     Function to print the status of an order with the format STATUS orderID state side price remainingQuantity, the state is LIVE for the orders in the book and STOP for the stops waiting for their trigger, whose price is the trigger price. An order that is not in the book is printed as STATUS orderID NONE
+     @param orderID: ID of the order, can be any sequence of printable characters
+     */
+    void PrintStatus(const string &orderID)
+    {
+        int slot=orderMap.find(orderID);
+        stats.mapLookups++;
+        if(slot<0)
+        {
+            cout<<"STATUS "<<orderID<<" NONE"<<endl;
+            return;
+        }
+        bool stop=arena.isStop(slot);
+        cout<<"STATUS "<<orderID<<(stop?" STOP ":" LIVE ")<<(arena.getSide(slot)==SideType::BUY?"BUY ":"SELL ")<<(stop?arena.getTriggerPrice(slot):arena.getPriceBid(slot))<<" "<<arena.getQuantity(slot)+arena.getHiddenQuantity(slot)<<endl;
+    }
+    /*
+     Function to print the 64 bit hash of the orders resting in the book with the format HASH hash, or HASH sequence hash when it is printed periodically. Two books with the same orders, prices, quantities and priorities have the same hash, so it can be compared between runs, backends or a primary and its standby without dumping the book
+     @param sequence: number of events processed, negative to print the hash alone
+     */
+    void PrintHash(long long sequence=-1)
+    {
+        ostringstream hash;
+        hash<<hex<<setw(16)<<setfill('0')<<QH.getBookHash();
+        cout<<"HASH ";
+        if(sequence>=0)
+        {
+            cout<<sequence<<" ";
+        }
+        cout<<hash.str()<<endl;
+    }
+    /*
+     Function to write a point in time snapshot of the book to a file without stalling the matching. The process is forked and the child, which sees the book as it was at the fork through copy on write, walks it, writes it with the format of PRINT followed by its HASH and exits. The parent goes on with the next event right away, it only pays for the fork
+     If the process can not be forked the snapshot is written in place
+     @param path: path of the file of the snapshot
+     */
+    void Snapshot(const string &path)
+    {
+        ReapSnapshots(false);
+        cout.flush();
+        pid_t pid=fork();
+        if(pid>0)
+        {
+            snapshots++;
+            return;
+        }
+        ofstream file(path);
+        streambuf *output=cout.rdbuf(file.rdbuf());
+        PrintOrderBook();
+        PrintHash();
+        cout.rdbuf(output);
+        file.close();
+        if(pid==0)
+        {
+            _exit(file?0:1);
+        }
+    }
+    /*
+     Function to reap the snapshot processes that finished, reporting the ones that could not write their file
+     @param wait: true to wait until all the snapshots are written, used before exiting
+     */
+    void ReapSnapshots(bool wait)
+    {
+        int status;
+        while(snapshots>0 && waitpid(-1,&status,wait?0:WNOHANG)>0)
+        {
+            snapshots--;
+            if(!WIFEXITED(status) || WEXITSTATUS(status)!=0)
+            {
+                cerr<<"snapshot failed"<<endl;
+            }
+        }
+    }
+    /*
+     Function to enable the publishing of the book in shared memory
+     @param name: name of the shared memory region, it must start with /
+     @return true if the region was created
+     */
+    bool OpenSharedBook(const string &name)
+    {
+        return publisher.open(name);
+    }
+    /*
+     Function to publish the BBO and the best levels of both sides in shared memory, it does nothing if publishing is disabled
+     */
+    void Publish()
+    {
+        if(!publisher.isOpen())
+        {
+            return;
+        }
+        vector<pair<int,long long>> depth[2]={TopLevels<Buy>(BookState::depth),TopLevels<Sell>(BookState::depth)};
+        publisher.publish(depth);
+    }
+    /*
+     Function to prefetch the memory that an upcoming command will touch, the entry of its order ID in the OrderIndex and the price level of its price, so the loads overlap with the processing of the commands before it
+     @param orderID: ID of the order of the command, empty if the command has none
+     @param orderType: Type of the order, can be BUY or SELL, any other value skips the price level
+     @param priceBid: Integer value representing the price of the order
+     */
+    void Prefetch(const string &orderID,const string &orderType,int priceBid)
+    {
+        if(orderID!="")
+        {
+            orderMap.prefetch(orderID);
+        }
+        if(orderType=="BUY")
+        {
+            PrefetchLevel<Buy>(priceBid);
+        }
+        else if(orderType=="SELL")
+        {
+            PrefetchLevel<Sell>(priceBid);
+        }
+    }
+    /*
+     Function to prefetch the price level of a side at a price, if it exists
+     @param priceBid: Integer value representing the price of the level
+     */
+    template<class Side>
+    void PrefetchLevel(int priceBid)
+    {
+        auto &sideLevels=QH.levelMap<Side>();
+        size_t bucket=sideLevels.bucket(priceBid);
+        auto bitr=sideLevels.begin(bucket);
+        if(bitr!=sideLevels.end(bucket))
+        {
+            __builtin_prefetch(&*bitr);
+        }
+    }
+    /*
+     Function to print the best levels of both sides, sell side first, with the format DEPTH side price quantity
+     @param n: number of levels printed per side
+     */
+    void PrintTopDepth(int n)
+    {
+        PrintDepth("SELL",TopLevels<Sell>(n));
+        PrintDepth("BUY",TopLevels<Buy>(n));
+    }
+    /*
+     Function to get the best levels of a side, best first. If the PriceLadder is dense the prices are read from it jumping between non empty levels with the ladderKernels and the quantities from the levels themselves, if the side is indexed directly they are read from its LevelBitmap, otherwise the best levels are selected from the map of levels with a partial sort
+     @param n: number of levels
+     @return prices of the levels with their quantity
+     */
+    template<class Side>
+    vector<pair<int,long long>> TopLevels(int n)
+    {
+        vector<pair<int,long long>> depth;
+        PriceLadder &ladder=QH.ladder<Side>();
+        if(ladder.isDense())
+        {
+            int price=Side::type==SideType::BUY?ladder.highest():ladder.lowest();
+            while(price!=0 && (int)depth.size()<n)
+            {
+                depth.push_back({price,QH.levelMap<Side>().find(price)->second.quantity});
+                price=Side::type==SideType::BUY?ladder.below(price):ladder.above(price);
+            }
+            return depth;
+        }
+        if(QH.isDirect<Side>())
+        {
+            const LevelBitmap &bitmap=QH.bitmap<Side>();
+            int price=Side::type==SideType::BUY?bitmap.highest():bitmap.lowest();
+            while(price!=0 && (int)depth.size()<n)
+            {
+                depth.push_back({price,QH.levelMap<Side>().find(price)->second.quantity});
+                price=Side::type==SideType::BUY?bitmap.below(price):bitmap.above(price);
+            }
+            return depth;
+        }
+        for(auto &currLevel:QH.levelMap<Side>())
+        {
+            if(currLevel.second.count>0)
+            {
+                depth.push_back({currLevel.first,currLevel.second.quantity});
+            }
+        }
+        size_t levels=min(depth.size(),(size_t)max(n,0));
+        partial_sort(depth.begin(),depth.begin()+levels,depth.end(),[](const pair<int,long long> &level1,const pair<int,long long> &level2){return Side::better(level1.first,level2.first);});
+        depth.resize(levels);
+        return depth;
+    }
+    /*
+     Function to print the OrderBook, buy and sell priority queues, sell side first
+     */
+    void PrintOrderBook()
+    {
+        cout<<"SELL: "<<endl;
+        PrintQueue<Sell>();
+        cout<<"BUY: "<<endl;
+        PrintQueue<Buy>();
+    }
+    /*
+     Function to print the price levels of a side in decreasing order. If the PriceLadder is dense the prices are read from it, jumping between non empty levels with the ladderKernels, and the quantities from the levels themselves
+     If the side is indexed directly they are read from its LevelBitmap, otherwise it creates a decreasing order map to store the price levels of the side and their quantities
+     */
+    template<class Side>
+    void PrintQueue()
+    {
+        PriceLadder &ladder=QH.ladder<Side>();
+        if(ladder.isDense())
+        {
+            for(int price=ladder.highest();price!=0;price=ladder.below(price))
+            {
+                cout<<price<<" "<<QH.levelMap<Side>().find(price)->second.quantity<<endl;
+            }
+            return;
+        }
+        if(QH.isDirect<Side>())
+        {
+            const LevelBitmap &bitmap=QH.bitmap<Side>();
+            for(int price=bitmap.highest();price!=0;price=bitmap.below(price))
+            {
+                cout<<price<<" "<<QH.levelMap<Side>().find(price)->second.quantity<<endl;
+            }
+            return;
+        }
+        map<int,long long,greater<int>,CountingAllocator<pair<const int,long long>,MemoryAccount::PRINT>> temp;
+        for(auto &currLevel:QH.levelMap<Side>())
+        {
+            if(currLevel.second.count>0)
+            {
+                temp[currLevel.first]=currLevel.second.quantity;
+            }
+        }
+        for(auto itr=temp.begin();itr!=temp.end();itr++)
+        {
+            cout<<itr->first<<" "<<itr->second<<endl;
+        }
+    }
+};
+
+/*
+ Struct of the command line options that configure an engine, so the engines built by the ReplayDriver are configured like the one reading the standard input
+ lazy: 1 for the lazy deletion mode, 0 for the eager one, -1 to keep the default of the backend
+ indexMode: name of the index of the price levels, see OrderBook::SetIndexMode
+ memoryBudget: maximum number of accounted live bytes above the fixed cost of the OrderIndex window, 0 if there is no budget
+ hashEvery: number of events between two periodic hashes, 0 to disable them
+ */
+struct EngineOptions
+{
+    int lazy=-1;
+    string indexMode="auto";
+    long long memoryBudget=0;
+    long long hashEvery=0;
+};
+
+/*
+ Class to handle user input, it has an OrderBook as a parameter and calls different order book functionalities depending on the user input
+ */
+class InputMachine
+{
+private:
+    /*
+     Fields
+     OB: The order book that will be used in the application
+     prefetchDistance: number of commands ahead of the one being processed whose memory is prefetched by HandleBatch
+     */
+    OrderBook OB;
+    static const int prefetchDistance=4;
+    long long sequence=0;
+    long long hashEvery=0;
+    /*
+     Function to parse the extra word of an order, it is only read for the execution types that use it and the empty words left by repeated spaces are skipped
+     @param inputLine: Vector of string with the input of the space separated input sentence
+     @param extra: value of the word, 0 for the execution types without it
+     @return false if the word is missing, is not an integer or, for the peak of an ICEBERG order and the limit price of a STOPLIMIT order, does not fit in an int, the order is then ignored like any other invalid order
+     */
+    static bool ParseExtra(const vector<string> &inputLine,long long &extra)
+    {
+        extra=0;
+        const string &executionType=inputLine[1];
+        if(executionType!="ICEBERG" && executionType!="STOPLIMIT" && executionType!="GTT")
+        {
+            return true;
+        }
+        for(size_t i=5;i<inputLine.size();i++)
+        {
+            if(inputLine[i]!="")
+            {
+                char *end;
+                errno=0;
+                extra=strtoll(inputLine[i].c_str(),&end,10);
+                return *end=='\0' && errno==0 && (executionType=="GTT" || extra<=INT_MAX);
+            }
+        }
+        return false;
+    }
+    /*
+     Function to insert the order described by the user input, the peak quantity of an ICEBERG order, the limit price of a STOPLIMIT order or the expiry tick of a GTT order is given as the next word. The owner of the order can be given as a last word starting with @, trailing empty words are dropped first
+     @param inputLine: Vector of string with the input of the space separated input sentence
+     @return true if the order was accepted by the book
+     */
+    bool InsertOrder(vector<string> &inputLine)
+    {
+        string owner;
+        while(inputLine.size()>5 && inputLine.back()=="")
+        {
+            inputLine.pop_back();
+        }
+        if(inputLine.size()>5 && inputLine.back()[0]=='@')
+        {
+            owner=inputLine.back().substr(1);
+            inputLine.pop_back();
+        }
+        long long extra;
+        if(!ParseExtra(inputLine,extra))
+        {
+            return false;
+        }
+        return OB.InsertOrder(inputLine[0],inputLine[1],stoi(inputLine[2]),stoi(inputLine[3]),inputLine[4],extra,owner);
+    }
+public:
+    /*
+     Function to configure the engine with the command line options
+     @param options: options of the engine
+     @return false if the index mode is unknown
+     */
+    bool configure(const EngineOptions &options)
+    {
+        if(options.lazy>=0)
+        {
+            OB.SetLazyDelete(options.lazy==1);
+        }
+        OB.SetMemoryBudget(options.memoryBudget);
+        hashEvery=options.hashEvery;
+        return OB.SetIndexMode(options.indexMode);
+    }
+    /*
+     Function to get the order book, used to configure it with the command line options
+     */
+    OrderBook& getOrderBook()
+    {
+        return OB;
+    }
+    /*
+     Function to process a batch of commands in order, while a command is processed the memory of the command prefetchDistance positions ahead is prefetched. The output is exactly the one of processing the commands one by one with HandleInput
+     @param batch: Vector with the space separated input sentences of the commands
+     @param accepted: if not null, it is filled with the result of HandleInput for each command
+     */
+    void HandleBatch(vector<vector<string>> &batch,vector<bool> *accepted=nullptr)
+    {
+        if(accepted)
+        {
+            accepted->assign(batch.size(),false);
+        }
+        for(size_t i=0;i<batch.size();i++)
+        {
+            if(i+prefetchDistance<batch.size())
+            {
+                Prefetch(batch[i+prefetchDistance]);
+            }
+            bool changed=HandleInput(batch[i]);
+            if(accepted)
+            {
+                (*accepted)[i]=changed;
+            }
+        }
+        tracer.record(TraceType::BATCH_END,batch.size());
+    }
+    /*
+     Function to prefetch the memory of a command, only orders, modifies and cancels are prefetched
+     @param inputLine: Vector of string with the input of the space separated input sentence
+     */
+    void Prefetch(const vector<string> &inputLine)
+    {
+        const string &command=inputLine[0];
+        if((command=="BUY"||command=="SELL") && inputLine.size()>4 && isdigit((unsigned char)inputLine[2][0]))
+        {
+            OB.Prefetch(inputLine[4],command,stoi(inputLine[2]));
+        }
+        else if(command=="MODIFY" && inputLine.size()>4 && isdigit((unsigned char)inputLine[3][0]))
+        {
+            OB.Prefetch(inputLine[1],inputLine[2],stoi(inputLine[3]));
+        }
+        else if(command=="CANCEL" && inputLine.size()>1)
+        {
+            OB.Prefetch(inputLine[1],"",0);
+        }
+    }
+    /* Funtion that depending on the user input, it call a different functionality from the order book, it takes a vector of strings (the space separated sentence provided by the user) and depending on the first letter of the first word determines which functionality of the order book will be called, using a switch. After every event the book is published in shared memory if it is enabled, the index of the price levels is reviewed and the hash of the book is printed if the periodic hash is enabled
+    @param inputLine: Vector of string with the input of the space separated input sentence
+    @return true if the command was accepted and can change the state of the book, these are the commands shipped to a standby. Queries, SNAPSHOT, TRACE and the orders, cancels and modifies that were ignored or rejected return false
+    */
+    bool HandleInput(vector<string> &inputLine)
+    {
+        tracer.record(TraceType::MESSAGE_BEGIN,sequence+1);
+        bool changed=false;
+        char operationToExecute=inputLine[0][0];
+        switch(operationToExecute)
+        {
+            case 'B':
+                if(inputLine[0]=="BARS")
+                {
+                    OB.SetBars(inputLine[1],stoll(inputLine[2]));
+                    changed=true;
+                }
+                else if(inputLine[0]=="BBO")
+                {
+                    OB.PrintBBO();
+                }
+                else
+                {
+                    changed=InsertOrder(inputLine);
+                }
+                break;
+            case 'S':
+                if(inputLine[0]=="STATS")
+                {
+                    OB.PrintStats();
+                }
+                else if(inputLine[0]=="SPREAD")
+                {
+                    OB.PrintSpread();
+                }
+                else if(inputLine[0]=="STATUS")
+                {
+                    OB.PrintStatus(inputLine[1]);
+                }
+                else if(inputLine[0]=="SNAPSHOT")
+                {
+                    OB.Snapshot(inputLine[1]);
+                }
+                else
+                {
+                    changed=InsertOrder(inputLine);
+                }
+                break;
+            case 'M':
+                if(inputLine[0]=="MASSCANCEL")
+                {
+                    OB.MassCancel(inputLine[1]);
+                    changed=true;
+                }
+                else if(inputLine[0]=="MEMORY")
+                {
+                    OB.PrintMemory();
+                }
+                else
+                {
+                    changed=OB.ModifyOrder(inputLine[1], inputLine[2],stoi(inputLine[3]),stoi(inputLine[4]));
+                }
+                break;
+            case 'C':
+                changed=OB.CancelOrder(inputLine[1]);
+                break;
+            case 'P':
+                if(inputLine[0]=="POLICY")
+                {
+                    OB.SetAllocationPolicy(inputLine[1],inputLine.size()>2 && inputLine[2]!=""?stoi(inputLine[2]):-1);
+                    changed=true;
+                }
+                else
+                {
+                    OB.PrintOrderBook();
+                }
+                break;
+            case 'D':
+                OB.PrintTopDepth(stoi(inputLine[1]));
+                break;
+            case 'A':
+                OB.PrintAnalytics();
+                break;
+            case 'T':
+                if(inputLine[0]=="TRACE")
+                {
+                    if(tracer.isEnabled() && !tracer.dump(inputLine.size()>1?inputLine[1]:""))
+                    {
+                        cerr<<"can not dump the trace"<<endl;
+                    }
+                }
+                else
+                {
+                    OB.AdvanceTime(stoll(inputLine[1]));
+                    changed=true;
+                }
+                break;
+            case 'H':
+                OB.PrintHash();
+                break;
+        }
+        OB.Publish();
+        OB.Adapt();
+        sequence++;
+        if(hashEvery>0 && sequence%hashEvery==0)
+        {
+            OB.PrintHash(sequence);
+        }
+        tracer.record(TraceType::MESSAGE_END,sequence);
+        return changed;
+    }
+};
+/*
+ Stream buffer that discards everything written to it, used to silence the output of the OrderBook
+ */
+struct NullBuffer:streambuf
+{
+    int overflow(int c) override
+    {
+        return c;
+    }
+};
 
-class QueueHandler
+/*
+ Class to replay a capture of commands open loop against a fresh OrderBook, to find the message rate a backend can sustain
+ A producer thread injects the commands at their intended send time, taken from the recorded timestamps (scaled by a speed factor) or from a fixed rate, into a single producer single consumer ring. The matching thread processes them and measures the response time of each one from its intended send time, not from the time it was dequeued, so the queueing delay of the messages that waited behind a slow one is counted (coordinated omission is corrected)
+ The output of the OrderBook is discarded while replaying, only the latency report is printed
+ */
+class ReplayDriver
 {
 private:
+    /*
+     Struct of a message in the ring: index of the command and its intended send time in nanoseconds of the steady clock
+     */
+    struct Message
+    {
+        size_t index;
+        long long sendTime;
+    };
     /*
      Fields
-     buyPriority decreasing order set recreating the functionality of a maximum heap for storing the buy orders in the OrderBook with insert, delete, and find operations in O(logN)
-     sellPriority increasing order set recreating the functionality of a minimum heap for storing the sell orders in the OrderBook with insert, delete, and find operations in O(logN)
+     commands: space separated commands of the capture
+     timestamps: recorded timestamp of each command in microseconds, empty if the capture has no timestamps
+     ring: messages injected by the producer and not processed yet, indexed by position modulo ringSize
+     head, tail: positions of the next message to inject and to process
      */
-    set<Order,greater<Order>> buyPriority;
-    set<Order> sellPriority;
-public:
+    static const size_t ringSize=1<<16;
+    vector<vector<string>> commands;
+    vector<long long> timestamps;
+    vector<Message> ring=vector<Message>(ringSize);
+    atomic<size_t> head{0};
+    atomic<size_t> tail{0};
     /*
-     Function to insert element at buyPriority maximum heap
-     @param currOrder: Order object reference to be inserted in buyPriority, pass by reference to avoid copying
+     Function to get the current time of the steady clock in nanoseconds
      */
-    void addToBuyQueue(Order &currOrder)
+    static long long nowNanos()
     {
-        buyPriority.insert(currOrder);
+        return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
     }
     /*
-     Function to insert element at sellPriority minimum heap
-     @param currOrder: Order object reference to be inserted in sellPriority, pass by reference to avoid copying
+     Function to wait until a time of the steady clock, it sleeps while the time is far and yields the processor when it is close
+     @param time: time in nanoseconds
      */
-    void addToSellQueue(Order &currOrder)
+    static void waitUntil(long long time)
     {
-        sellPriority.insert(currOrder);
+        long long remaining=time-nowNanos();
+        if(remaining>100000)
+        {
+            this_thread::sleep_for(chrono::nanoseconds(remaining-50000));
+        }
+        while(nowNanos()<time)
+        {
+            this_thread::yield();
+        }
     }
     /*
-     Function to delete element from both priority queues, deciding to call the proper function depending on the orderType
-     @param currOrder: Order object reference to be deleted in the queue, pass by reference to avoid copying
+     Function to get the intended send time of a command relative to the start of the replay
+     @param i: index of the command
+     @param rate: messages per second, if it is 0 the recorded timestamps are used
+     @param speed: factor applied to the recorded timestamps, 2 replays twice as fast
      */
-    void deleteFromQueue(Order &currOrder)
+    long long offset(size_t i,double rate,double speed) const
     {
-        string orderType=currOrder.getOrderType();
-        if(orderType=="BUY")
+        if(rate>0)
         {
-            Delete(buyPriority,currOrder);
+            return (long long)(i*1e9/rate);
         }
-        else if(orderType=="SELL")
+        return (long long)((timestamps[i]-timestamps[0])*1000/speed);
+    }
+public:
+    /*
+     Function to load a capture, one command per line. A line can start with its timestamp in microseconds, then the timestamps are used when no rate is given
+     @param file: path of the capture
+     @return true if the capture could be read
+     */
+    bool load(const string &file)
+    {
+        ifstream in(file);
+        if(!in)
+        {
+            return false;
+        }
+        string input;
+        bool timed=true;
+        while(getline(in,input))
+        {
+            vector<string> inputLine;
+            stringstream ss(input);
+            while(ss.good())
+            {
+                string inputWord;
+                getline(ss,inputWord,' ');
+                inputLine.push_back(inputWord);
+            }
+            if(inputLine[0].empty())
+            {
+                continue;
+            }
+            if(timed && isdigit((unsigned char)inputLine[0][0]) && inputLine.size()>1)
+            {
+                timestamps.push_back(stoll(inputLine[0]));
+                inputLine.erase(inputLine.begin());
+            }
+            else
+            {
+                timed=false;
+            }
+            commands.push_back(move(inputLine));
+        }
+        if(!timed || timestamps.size()!=commands.size())
         {
-            Delete(sellPriority,currOrder);
+            timestamps.clear();
         }
+        return true;
     }
     /*
-     Overloaded Function to delete element from sellPriority queue
-     @param currOrder: Order object reference to be deleted in the sellPriority queue, pass by reference to avoid copying
+     Function to check if the capture has recorded timestamps
      */
-    void Delete(set<Order> &currQueue,Order &currOrder)
+    bool isTimed() const
     {
-        currQueue.erase(currOrder);
+        return !timestamps.empty();
     }
     /*
-     Overloaded Function to delete element from buyPriority queue
-     @param currOrder: Order object reference to be deleted in the buyPriority queue, pass by reference to avoid copying
+     Function to replay the capture against a fresh OrderBook and print the latency report with the format REPLAY rate messages p50 p90 p99 p999 max, the latencies in nanoseconds from the intended send time
+     @param rate: messages per second, 0 to use the recorded timestamps
+     @param speed: factor applied to the recorded timestamps
+     @param options: options of the engine, the same ones of the engine that reads the standard input
      */
-    void Delete(set<Order,greater<Order>> &currQueue,Order &currOrder)
+    void run(double rate,double speed,const EngineOptions &options)
     {
-        currQueue.erase(currOrder);
+        if(commands.empty())
+        {
+            return;
+        }
+        InputMachine machine;
+        machine.configure(options);
+        vector<long long> latencies(commands.size());
+        head.store(0);
+        tail.store(0);
+        NullBuffer nullBuffer;
+        streambuf *output=cout.rdbuf(&nullBuffer);
+        long long start=nowNanos()+1000000;
+        thread producer([&]()
+        {
+            for(size_t i=0;i<commands.size();i++)
+            {
+                long long sendTime=start+offset(i,rate,speed);
+                waitUntil(sendTime);
+                size_t h=head.load(memory_order_relaxed);
+                while(h-tail.load(memory_order_acquire)>=ringSize)
+                {
+                    this_thread::yield();
+                }
+                ring[h%ringSize]={i,sendTime};
+                head.store(h+1,memory_order_release);
+            }
+        });
+        for(size_t processed=0;processed<commands.size();)
+        {
+            size_t t=tail.load(memory_order_relaxed);
+            if(t==head.load(memory_order_acquire))
+            {
+                this_thread::yield();
+                continue;
+            }
+            Message message=ring[t%ringSize];
+            vector<string> inputLine=commands[message.index];
+            machine.HandleInput(inputLine);
+            latencies[processed++]=nowNanos()-message.sendTime;
+            tail.store(t+1,memory_order_release);
+        }
+        producer.join();
+        cout.rdbuf(output);
+        sort(latencies.begin(),latencies.end());
+        auto percentile=[&](double p){return latencies[min(latencies.size()-1,(size_t)(p*latencies.size()))];};
+        cout<<"REPLAY "<<(rate>0?to_string((long long)rate):"RECORDED")<<" "<<latencies.size()<<" "<<percentile(0.5)<<" "<<percentile(0.9)<<" "<<percentile(0.99)<<" "<<percentile(0.999)<<" "<<latencies.back()<<endl;
     }
-    friend class OrderBook;
 };
 
 /*
- Class to represent an OrderBook, handling the order book actions (methods) such as insert, delete, cancel, modify,and update(reminder) order. It also handles trades (matches) and prints the reminding orders in the order book as well as the trades. It assigns a turn to each order in both orderBooks, this value is used when printing the trades to know which order came first
+ Class to ship the command log of a primary engine to a standby engine over a Unix socket
+ The matching thread only appends the accepted commands of each batch to the pending log under a mutex, a sender thread numbers the pending commands and sends them in batches, and an ack thread reads the sequences acknowledged by the standby. At most window commands can be sent and not acknowledged, when the window is full the sender waits for acks, so a slow standby never blocks the matching thread until the pending log itself is drained
  */
-
-class OrderBook
+class LogShipper
 {
 private:
     /*
      Fields
-     orderMap: unordered_map of all orders buy and sell orders. Internally unordered_maps work as hash tables, which are great for storing unordered records with insert, delete, and find operations in O(1)
-     turn: variable general to all the order book that assigns turns to all orders, buy and sell orders. This value is used when determing print order between buy and sell orders
-     QH: object of class Queue Handler that works as described above
+     window: maximum number of commands sent and not acknowledged
+     fd: socket connected to the standby, -1 if replication is disabled
+     lock, ready: protect the fields below and wake up the waiting threads
+     pending: commands appended by the matching thread and not sent yet
+     sent: sequence of the last command sent
+     acked: sequence of the last command acknowledged by the standby
+     closing: true when the primary stops and the sender has to flush the log
+     broken: true if the socket failed, from then on the commands are dropped
+     sender, acker: sender and ack threads
      */
-    unordered_map<string, Order> orderMap;
-    int turn=0;
-    QueueHandler QH;
-    
-public:
+    static const long long window=4096;
+    int fd=-1;
+    mutex lock;
+    condition_variable ready;
+    vector<string> pending;
+    long long sent=0;
+    long long acked=0;
+    bool closing=false;
+    bool broken=false;
+    thread sender;
+    thread acker;
     /*
-     Function to insert element at OrderBook checking if all the parameters passed are valid, it distinguishes between GFD and IOC execution types since they have different behaviours and life spans. It inserts the order in the hash map and creates the order with the input parameters
-     @param orderType: Type of the order, can be BUY or SELL
-     @param executionType: Execution type of the order, can be GFD (Good for Day) or IOC (Insert or Cancel)
-     @param priceBid: Integer value representing the price bid related to the order
-     @param quantity: Integer value representing the quantity of the order
-     @param orderID: ID of the order, can be any sequence of printable characters
+     Function of the sender thread, it takes the pending commands in batches that fit in the window and writes each batch with one system call
      */
-    void InsertOrder(string orderType,string executionType,int priceBid,int quantity,string orderID)
+    void sendLoop()
     {
-        if(orderID!="" && priceBid>0 && quantity>0 && (orderType=="BUY"||orderType=="SELL") && (executionType=="IOC"||executionType=="GFD"))
+        vector<string> batch;
+        string buffer;
+        while(true)
         {
-            orderMap[orderID].createOrder(orderID,orderType,executionType,priceBid,quantity,++turn);
-            if(executionType=="GFD")
+            long long sequence;
+            {
+                unique_lock<mutex> guard(lock);
+                ready.wait(guard,[this]{return broken || ((!pending.empty() || closing) && sent-acked<window);});
+                if(broken || (pending.empty() && closing))
+                {
+                    return;
+                }
+                size_t count=min(pending.size(),(size_t)(window-(sent-acked)));
+                batch.assign(make_move_iterator(pending.begin()),make_move_iterator(pending.begin()+count));
+                pending.erase(pending.begin(),pending.begin()+count);
+                sequence=sent;
+                sent+=count;
+            }
+            buffer.clear();
+            for(string &command:batch)
             {
-                InsertOrderGFD(orderID);
+                buffer+=to_string(++sequence)+" "+command+"\n";
             }
-            else if(executionType=="IOC")
+            if(!writeAll(fd,buffer))
             {
-                InsertOrderIOC(orderID);
+                lock_guard<mutex> guard(lock);
+                shutdownSocket();
+                ready.notify_all();
+                return;
             }
+            tracer.record(TraceType::LOG_SHIPPED,sequence);
         }
     }
     /*
-     Function to insert Good For Day order at corresponding buy or sell priority queue, the order remains there until traded. After inserting any order it checks the order book for a match (trade)
-     @param orderID: ID of the order, can be any sequence of printable characters
+     Function of the ack thread, it reads the lines ACK sequence sent by the standby
      */
-    void InsertOrderGFD(string orderID)
+    void ackLoop()
     {
-        string orderType=orderMap[orderID].getOrderType();
-        if(orderType=="BUY")
-        {
-            QH.addToBuyQueue(orderMap[orderID]);
-        }
-        else if(orderType=="SELL")
+        string buffer;
+        char chunk[4096];
+        while(true)
         {
-            QH.addToSellQueue(orderMap[orderID]);
+            ssize_t n=read(fd,chunk,sizeof(chunk));
+            if(n<=0)
+            {
+                lock_guard<mutex> guard(lock);
+                shutdownSocket();
+                ready.notify_all();
+                return;
+            }
+            buffer.append(chunk,n);
+            size_t end;
+            while((end=buffer.find('\n'))!=string::npos)
+            {
+                long long sequence=stoll(buffer.substr(4,end-4));
+                buffer.erase(0,end+1);
+                lock_guard<mutex> guard(lock);
+                acked=max(acked,sequence);
+                tracer.record(TraceType::LOG_ACKED,sequence);
+            }
+            ready.notify_all();
         }
-        Match();
     }
     /*
-     Function to insert Immediate or Cancel order at corresponding buy or sell priority queue, the order requests to be traded (if possible) immediately, then its canceled. It gets removed from the corresponding priority queue and then from the hash table
-     @param orderID: ID of the order, can be any sequence of printable characters
+     Function to stop using the socket after an error or once the log is flushed, the primary keeps running without replication. It must be called with the lock held
      */
-    void InsertOrderIOC(string orderID)
+    void shutdownSocket()
     {
-        string orderType=orderMap[orderID].getOrderType();
-        if(orderType=="BUY")
+        broken=true;
+        pending.clear();
+        shutdown(fd,SHUT_RDWR);
+    }
+public:
+    ~LogShipper()
+    {
+        stop();
+    }
+    /*
+     Function to write a whole buffer to a socket. It sends with MSG_NOSIGNAL so a peer that has gone away makes it fail with EPIPE instead of raising a SIGPIPE that would kill the process
+     @param sock: socket
+     @param buffer: data to write
+     @return false if the socket failed or the peer is gone
+     */
+    static bool writeAll(int sock,const string &buffer)
+    {
+        size_t done=0;
+        while(done<buffer.size())
         {
-            QH.addToBuyQueue(orderMap[orderID]);
-            if(orderID==QH.buyPriority.begin()->getOrderID())
+            ssize_t n=send(sock,buffer.data()+done,buffer.size()-done,MSG_NOSIGNAL);
+            if(n<0 && errno==EINTR)
+            {
+                continue;
+            }
+            if(n<=0)
             {
-                Match();
+                return false;
             }
+            done+=n;
         }
-        else if(orderType=="SELL")
+        return true;
+    }
+    /*
+     Function to connect to a standby listening on a Unix socket and start the sender and ack threads
+     @param path: path of the Unix socket
+     @return true if the standby is connected
+     */
+    bool start(const string &path)
+    {
+        sockaddr_un address{};
+        address.sun_family=AF_UNIX;
+        strncpy(address.sun_path,path.c_str(),sizeof(address.sun_path)-1);
+        fd=socket(AF_UNIX,SOCK_STREAM,0);
+        if(fd<0 || connect(fd,(sockaddr*)&address,sizeof(address))!=0)
         {
-            QH.addToSellQueue(orderMap[orderID]);
-            if(orderID==QH.sellPriority.begin()->getOrderID())
+            if(fd>=0)
             {
-                Match();
+                close(fd);
             }
+            fd=-1;
+            return false;
         }
-        QH.deleteFromQueue(orderMap[orderID]);
-        orderMap.erase(orderID);
+        sender=thread(&LogShipper::sendLoop,this);
+        acker=thread(&LogShipper::ackLoop,this);
+        return true;
     }
     /*
-     Function to modify element at OrderBook checking if all the parameters passed are valid. It searches the order in the hash map in O(1) and proceed to modifying the order if it is found. It deletes the order from the priority queue since the turn based priority will be lost, then modifies the parameters of the order , and finally inserts the new order into the corresponging queue
-     @param orderID: ID of the order, can be any sequence of printable characters
-     @param orderType: Type of the order, can be BUY or SELL
-     @param priceBid: Integer value representing the price bid related to the order
-     @param quantity: Integer value representing the quantity of the order
+     Function to check if the log is shipped
+     */
+    bool isActive() const
+    {
+        return fd>=0;
+    }
+    /*
+     Function called by the matching thread after processing a batch of commands to append the accepted ones to the log, so the orders rejected by the primary, the queries and the commands with side effects outside the book like SNAPSHOT and TRACE are never applied by the standby
+     @param commands: the input sentences of the commands
+     @param accepted: true for the commands accepted by the book, as returned by InputMachine::HandleBatch
      */
-    void ModifyOrder(string orderID,string orderType,int priceBid,int quantity)
+    void append(vector<string> &commands,const vector<bool> &accepted)
     {
-        auto fitr=orderMap.find(orderID);
-        if(fitr!=orderMap.end())
+        if(commands.empty())
+        {
+            return;
+        }
         {
-            if(priceBid>0 && quantity>0 && (orderType=="BUY"||orderType=="SELL"))
+            lock_guard<mutex> guard(lock);
+            if(broken)
             {
-                QH.deleteFromQueue(fitr->second);
-                orderMap[orderID].modifyOrder(orderType,priceBid,quantity,++turn);
-                if(orderType=="BUY")
-                {
-                    QH.addToBuyQueue(orderMap[orderID]);
-                }
-                else if(orderType=="SELL")
+                return;
+            }
+            for(size_t i=0;i<commands.size();i++)
+            {
+                if(accepted[i])
                 {
-                    QH.addToSellQueue(orderMap[orderID]);
+                    pending.push_back(move(commands[i]));
                 }
-                Match();
             }
         }
+        ready.notify_one();
     }
     /*
-     Function to update an orders quantity in the order book and priority queue. It is called when an order that was traded has a reminder quantity, this order needs to be updated with the new quantity, but wont loose the turn priority, and the other parameters dont get modified.
-     @param orderID: ID of the order, can be any sequence of printable characters
-     @param newQuantity: Integer value representing the quantity of the order
+     Function to flush the log, wait until the standby acknowledged every command and stop the threads
      */
-    void UpdateOrder(string orderID,int newQuantity)
-     {
-        orderMap[orderID].setQuantity(newQuantity);
-        string orderType=orderMap[orderID].getOrderType();
-        QH.deleteFromQueue(orderMap[orderID]);
-        if(orderType=="BUY")
+    void stop()
+    {
+        if(fd<0)
         {
-            QH.addToBuyQueue(orderMap[orderID]);
+            return;
         }
-        else if(orderType=="SELL")
         {
-            QH.addToSellQueue(orderMap[orderID]);
+            lock_guard<mutex> guard(lock);
+            closing=true;
         }
-     }
-    /*
-     Function to cancel an order in the order book and priority queue. It searches the order in the hash map in O(1) and proceed to cancel the order if it is found deleting it from the priority queue and erasing it from the hash table
-     @param orderID: ID of the order, can be any sequence of printable characters
-     @param newQuantity: Integer value representing the quantity of the order
-     */
-    void CancelOrder(string orderID)
-    {
-        auto fitr=orderMap.find(orderID);
-        if(fitr!=orderMap.end())
+        ready.notify_all();
+        sender.join();
         {
-            QH.deleteFromQueue(fitr->second);
-            orderMap.erase(fitr);
+            unique_lock<mutex> guard(lock);
+            ready.wait(guard,[this]{return broken || acked>=sent;});
+            shutdownSocket();
         }
+        acker.join();
+        close(fd);
+        fd=-1;
     }
+};
+
+/*
+ Class to run a standby engine, it listens on a Unix socket for a primary, applies the commands shipped by it to its own OrderBook in sequence and acknowledges them after each batch read
+ When the primary disconnects the standby takes over at the last sequence applied, which is the last one acknowledged
+ */
+class LogReceiver
+{
+public:
     /*
-     Function to check for matches in the orderbook, it compares than neither priority queue is empty and then compares the top most element of each queue (buy and sell) everytime the buy price is greater than or equal to the sell price, it crosses a match and does a trade. It calculates the minimum quantity between the buy quantity and sell quantity since that will be the traded quantity, and prints the TRADE message. Then it calculates the reminder quantity as the difference between buy and sell traded orders, it updates the order with the greater quantity with the reminder, and deletes the other order. If both orders have the same quantity both get deleted. It keeps doing this process until no trades can be made, this function gets called everytime an order is inserted
+     Function to receive and apply the log of a primary, the output of the OrderBook is discarded while it mirrors the primary
+     @param path: path of the Unix socket where it listens
+     @param machine: InputMachine of the standby engine
+     @return sequence of the last command applied, -1 if the socket could not be opened
      */
-    void Match()
+    static long long run(const string &path,InputMachine &machine)
     {
-        bool keepMatching=true;
-        while(keepMatching)
+        sockaddr_un address{};
+        address.sun_family=AF_UNIX;
+        strncpy(address.sun_path,path.c_str(),sizeof(address.sun_path)-1);
+        unlink(path.c_str());
+        int listener=socket(AF_UNIX,SOCK_STREAM,0);
+        if(listener<0 || ::bind(listener,(sockaddr*)&address,sizeof(address))!=0 || listen(listener,1)!=0)
+        {
+            return -1;
+        }
+        int fd=accept(listener,nullptr,nullptr);
+        close(listener);
+        unlink(path.c_str());
+        if(fd<0)
+        {
+            return -1;
+        }
+        NullBuffer nullBuffer;
+        streambuf *output=cout.rdbuf(&nullBuffer);
+        long long applied=0;
+        string buffer;
+        char chunk[65536];
+        ssize_t n;
+        while((n=read(fd,chunk,sizeof(chunk)))>0)
         {
-            if((!QH.buyPriority.empty()&&!QH.sellPriority.empty())&&(QH.buyPriority.begin()->getPriceBid()>=QH.sellPriority.begin()->getPriceBid()))
+            buffer.append(chunk,n);
+            size_t start=0,end;
+            while((end=buffer.find('\n',start))!=string::npos)
             {
-                int buyQty=QH.buyPriority.begin()->getQuantity();
-                int sellQty=QH.sellPriority.begin()->getQuantity();
-                int minQty=min(buyQty,sellQty);
-                PrintMatch(minQty);
-                if(buyQty!=sellQty)
-                {
-                    int nwqty=0;
-                    if(buyQty>sellQty)
-                    {
-                        nwqty=buyQty-sellQty;
-                        UpdateOrder(QH.buyPriority.begin()->getOrderID(),nwqty);
-                        CancelOrder(QH.sellPriority.begin()->getOrderID());
-                    }
-                    else
-                    {
-                        nwqty=sellQty-buyQty;
-                        UpdateOrder(QH.sellPriority.begin()->getOrderID(),nwqty);
-                        CancelOrder(QH.buyPriority.begin()->getOrderID());
-                    }
-                }
-                else
+                size_t space=buffer.find(' ',start);
+                applied=stoll(buffer.substr(start,space-start));
+                vector<string> inputLine;
+                stringstream ss(buffer.substr(space+1,end-space-1));
+                while(ss.good())
                 {
-                    CancelOrder(QH.buyPriority.begin()->getOrderID());
-                    CancelOrder(QH.sellPriority.begin()->getOrderID());
+                    string inputWord;
+                    getline(ss,inputWord,' ');
+                    inputLine.push_back(inputWord);
                 }
+                machine.HandleInput(inputLine);
+                start=end+1;
             }
-            else
+            buffer.erase(0,start);
+            if(!LogShipper::writeAll(fd,"ACK "+to_string(applied)+"\n"))
             {
-                keepMatching=false;
+                break;
             }
         }
+        close(fd);
+        cout.rdbuf(output);
+        return applied;
     }
-    /*
-     Function to print the output of a trade. It is called everytime a trade happens quantity, It assigns the printing order depending on the turn and outputs the TRADE message
-     @param minQty: Minimum quantity between the buy quantity and sell quantity since that is the traded quantity
-     */
-    void PrintMatch(int minQty)
+};
+
+/*
+ Signal handler that asks the tracer to dump the trace, the dump itself is done by the main loop before the next command
+ */
+void requestTraceDump(int)
+{
+    tracer.requestDump();
+}
+
+/*
+ Command line options
+ --lazy: leave the empty price levels in the containers as tombstones and discard them when they reach the top
+ --eager: delete the empty price levels from the containers right away
+ --index=auto|native|ladder|bitmap: index the price levels of each side with the container of the build, with the PriceLadder (the LevelBitmap when it is not dense), with the LevelBitmap, or choose at runtime from the number of levels and the density of the ladder (the default)
+ --shm=/name: publish the BBO and the best levels in the shared memory region /name after every event
+ --hash-every=n: print the hash of the book every n events
+ --mem-budget=n[k|m|g]: reject the new resting orders while the accounted memory, without the fixed cost of the OrderIndex window, is over n bytes (kilobytes, megabytes or gigabytes)
+ --trace[=path]: record trace events in a ring buffer per thread, they are dumped to path (trace.json by default) by the TRACE command and on SIGUSR1, as Chrome trace JSON or in binary if path ends in .bin
+ --batch=n: read the input in batches of up to n commands and process them with HandleBatch, prefetching the commands ahead
+ --shm-read=/name: print a snapshot of the book published in the shared memory region /name by another process and exit
+ --replay=file: replay the capture in file open loop with the ReplayDriver and print the latency report instead of reading the standard input
+ --rate=n: replay at n messages per second instead of the recorded timestamps
+ --speed=x: replay the recorded timestamps x times faster
+ --sweep=r1,r2,...: replay once per rate and print a latency report per rate
+ --primary=path: ship the accepted commands that change the book to the standby listening on the Unix socket path
+ --standby=path: listen on the Unix socket path and apply the commands shipped by a primary, when it disconnects print TAKEOVER sequence and go on reading the standard input
+ */
+int main(int argc, const char * argv[]) {
+    
+    string input;
+    InputMachine IM;
+    int batchSize=1;
+    EngineOptions options;
+    string replayFile;
+    double rate=0;
+    double speed=1;
+    vector<double> sweep;
+    string standbyPath;
+    LogShipper shipper;
+    for(int i=1;i<argc;i++)
     {
-        int buyTurn= orderMap[QH.buyPriority.begin()->getOrderID()].getTurn();
-        int sellTurn= orderMap[QH.sellPriority.begin()->getOrderID()].getTurn();
-        if(buyTurn<sellTurn)
+        string option=argv[i];
+        if(option=="--lazy")
         {
-            cout<<"TRADE " + QH.buyPriority.begin()->getOrderID() + " "<<QH.buyPriority.begin()->getPriceBid()<<" "<<minQty<<" " + QH.sellPriority.begin()->getOrderID() + " "<<QH.sellPriority.begin()->getPriceBid()<<" "<<minQty<<endl;
+            options.lazy=1;
         }
-        else
+        else if(option=="--eager")
         {
-            cout<<"TRADE " + QH.sellPriority.begin()->getOrderID() + " "<<QH.sellPriority.begin()->getPriceBid()<<" "<< minQty<<" " + QH.buyPriority.begin()->getOrderID() + " "<<QH.buyPriority.begin()->getPriceBid()<<" "<< minQty<<endl;
+            options.lazy=0;
         }
-    }
-    /*
-     Function to print the OrderBook, buy and sell priority queues, it decides what function to call depending if buy or sell
-     */
-    void PrintOrderBook()
-    {
-        cout<<"SELL: "<<endl;
-        PrintSell(QH.sellPriority);
-        cout<<"BUY: "<<endl;
-        PrintBuy(QH.buyPriority);
-    }
-    /*Overloaded Function to print from buyPriority queue, it creates a decreasing order map to store the values in the buyPriority queue and add up the quantities with the same price bid. It passes the value by reference to avoid copying
-    @param currQueue: buyPriority queue
-    */
-    void PrintBuy(set<Order,greater<Order>> &currQueue)
-    {
-        map<int,int,greater<int>> temp;
-        for(Order currOrder:currQueue)
+        else if(option.rfind("--replay=",0)==0)
         {
-            temp[currOrder.getPriceBid()]+=currOrder.getQuantity();
+            replayFile=option.substr(9);
         }
-        for(auto itr=temp.begin();itr!=temp.end();itr++)
+        else if(option.rfind("--rate=",0)==0)
         {
-            cout<<itr->first<<" "<<itr->second<<endl;
+            rate=stod(option.substr(7));
+        }
+        else if(option.rfind("--speed=",0)==0)
+        {
+            speed=max(stod(option.substr(8)),1e-9);
+        }
+        else if(option.rfind("--primary=",0)==0)
+        {
+            if(!shipper.start(option.substr(10)))
+            {
+                cerr<<"can not connect to standby "<<option.substr(10)<<endl;
+                return 1;
+            }
+        }
+        else if(option.rfind("--standby=",0)==0)
+        {
+            standbyPath=option.substr(10);
+        }
+        else if(option.rfind("--sweep=",0)==0)
+        {
+            stringstream ss(option.substr(8));
+            string sweepRate;
+            while(getline(ss,sweepRate,','))
+            {
+                sweep.push_back(stod(sweepRate));
+            }
+        }
+        else if(option.rfind("--index=",0)==0)
+        {
+            options.indexMode=option.substr(8);
+        }
+        else if(option=="--trace" || option.rfind("--trace=",0)==0)
+        {
+            tracer.enable(option=="--trace"?"trace.json":option.substr(8));
+            signal(SIGUSR1,requestTraceDump);
+        }
+        else if(option.rfind("--mem-budget=",0)==0)
+        {
+            size_t digits;
+            long long budget=max(stoll(option.substr(13),&digits),0LL);
+            char unit=tolower(option.size()>13+digits?option[13+digits]:'b');
+            budget<<=unit=='k'?10:unit=='m'?20:unit=='g'?30:0;
+            options.memoryBudget=budget;
+        }
+        else if(option.rfind("--hash-every=",0)==0)
+        {
+            options.hashEvery=max(stoll(option.substr(13)),0LL);
+        }
+        else if(option.rfind("--batch=",0)==0)
+        {
+            batchSize=max(stoi(option.substr(8)),1);
+        }
+        else if(option.rfind("--shm=",0)==0)
+        {
+            if(!IM.getOrderBook().OpenSharedBook(option.substr(6)))
+            {
+                cerr<<"can not create shared memory "<<option.substr(6)<<endl;
+                return 1;
+            }
+        }
+        else if(option.rfind("--shm-read=",0)==0)
+        {
+            BookState state;
+            if(!BookPublisher::read(option.substr(11),state))
+            {
+                cerr<<"can not open shared memory "<<option.substr(11)<<endl;
+                return 1;
+            }
+            cout<<"SNAPSHOT "<<state.events<<endl;
+            for(int i=0;i<state.levels[1];i++)
+            {
+                cout<<"DEPTH SELL "<<state.prices[1][i]<<" "<<state.quantities[1][i]<<endl;
+            }
+            for(int i=0;i<state.levels[0];i++)
+            {
+                cout<<"DEPTH BUY "<<state.prices[0][i]<<" "<<state.quantities[0][i]<<endl;
+            }
+            return 0;
         }
     }
-    /*Overloaded Function to print from sellPriority queue, it creates a increasing order map to store the values in the sellPriority queue and add up the quantities with the same price bid. It passes the value by reference to avoid copying
-    @param currQueue: sellPriority queue
-    */
-    void PrintSell(set<Order> &currQueue)
+    if(!IM.configure(options))
+    {
+        cerr<<"unknown index mode "<<options.indexMode<<endl;
+        return 1;
+    }
+    if(replayFile!="")
     {
-        map<int,int,greater<int>> temp;
-        for(Order currOrder:currQueue)
+        ReplayDriver driver;
+        if(!driver.load(replayFile))
         {
-            temp[currOrder.getPriceBid()]+=currOrder.getQuantity();
+            cerr<<"can not read "<<replayFile<<endl;
+            return 1;
         }
-        for(auto itr=temp.begin();itr!=temp.end();itr++)
+        if(sweep.empty())
         {
-            cout<<itr->first<<" "<<itr->second<<endl;
+            sweep.push_back(rate);
+        }
+        for(double sweepRate:sweep)
+        {
+            if(sweepRate<=0 && !driver.isTimed())
+            {
+                cerr<<"the capture has no timestamps, a rate is needed"<<endl;
+                return 1;
+            }
+            driver.run(sweepRate,speed,options);
         }
+        return 0;
     }
-};
-
-/*
- Class to handle user input, it has an OrderBook as a parameter and calls different order book functionalities depending on the user input
- */
-class InputMachine
-{
-private:
-    /*
-     Fields
-     OB: The order book that will be used in the application
-     */
-    OrderBook OB;
-public:
-    /* Funtion that depending on the user input, it call a different functionality from the order book, it takes a vector of strings (the space separated sentence provided by the user) and depending on the first letter of the first word determines which functionality of the order book will be called, using a switch
-    @param inputLine: Vector of string with the input of the space separated input sentence
-    */
-    void HandleInput(vector<string> &inputLine)
+    if(standbyPath!="")
     {
-        char operationToExecute=inputLine[0][0];
-        switch(operationToExecute)
+        long long applied=LogReceiver::run(standbyPath,IM);
+        if(applied<0)
         {
-            case 'B':
-                OB.InsertOrder(inputLine[0],inputLine[1],stoi(inputLine[2]),stoi(inputLine[3]),inputLine[4]);
-                break;
-            case 'S':
-                OB.InsertOrder(inputLine[0],inputLine[1],stoi(inputLine[2]),stoi(inputLine[3]),inputLine[4]);
-                break;
-            case 'M':
-                OB.ModifyOrder(inputLine[1], inputLine[2],stoi(inputLine[3]),stoi(inputLine[4]));
-                break;
-            case 'C':
-                OB.CancelOrder(inputLine[1]);
-                break;
-            case 'P':
-                OB.PrintOrderBook();
-                break;
+            cerr<<"can not listen on "<<standbyPath<<endl;
+            return 1;
         }
+        cout<<"TAKEOVER "<<applied<<endl;
     }
-};
-int main(int argc, const char * argv[]) {
-    
-    string input;
-    InputMachine IM;
+    vector<vector<string>> batch;
+    vector<string> lines;
+    vector<bool> accepted;
     while(getline(cin, input)){
+        tracer.record(TraceType::MESSAGE_RECEIVED,input.size());
+        tracer.dumpIfRequested();
+        if(shipper.isActive())
+        {
+            lines.push_back(input);
+        }
         vector<string> inputLine;
         stringstream ss(input);
         while (ss.good())
@@ -516,7 +5127,19 @@ int main(int argc, const char * argv[]) {
             getline(ss, inputWord, ' ');
             inputLine.push_back(inputWord);
         }
-       IM.HandleInput(inputLine);
+        tracer.record(TraceType::PARSE_DONE,inputLine.size());
+       batch.push_back(move(inputLine));
+        if((int)batch.size()>=batchSize)
+        {
+            IM.HandleBatch(batch,shipper.isActive()?&accepted:nullptr);
+            shipper.append(lines,accepted);
+            batch.clear();
+            lines.clear();
+        }
     }
+    IM.HandleBatch(batch,shipper.isActive()?&accepted:nullptr);
+    shipper.append(lines,accepted);
+    IM.getOrderBook().ReapSnapshots(true);
+    shipper.stop();
     return 0;
 }